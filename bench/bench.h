@@ -0,0 +1,97 @@
+#pragma once
+
+#include <cmath>
+#include <cstdio>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <functional>
+
+/*
+* @brief 微基准工具
+* 不依赖第三方框架,预热后按最短时间校准循环次数,重复测量取中位数.
+*/
+namespace bench {
+	//命令行第一个参数作为名称过滤
+	struct Filter {
+		std::string pattern;
+
+		bool match(const std::string& name) const
+		{
+			return pattern.empty() || name.find(pattern) != std::string::npos;
+		}
+	};
+
+	/*
+	* @brief 运行一个基准并输出结果
+	* @param[in] filter 名称过滤
+	* @param[in] name 名称
+	* @param[in] func 被测函数
+	* @param[in] minTime 每次测量的最短时间(s)
+	* @param[in] repeats 重复测量的次数
+	* @return double 每次调用的耗时中位数(ns)
+	*/
+	inline double run(const Filter& filter, const std::string& name,
+		const std::function<void()>& func, double minTime = 0.05, int repeats = 7)
+	{
+		if (!filter.match(name)) {
+			return 0;
+		}
+
+		typedef std::chrono::steady_clock clock;
+		auto measure = [&](long long iterations) {
+			auto start = clock::now();
+			for (long long i = 0; i < iterations; ++i) {
+				func();
+			}
+			return std::chrono::duration<double>(clock::now() - start).count();
+		};
+
+		func();
+		long long iterations = 1;
+		for (;;) {
+			double elapsed = measure(iterations);
+			if (elapsed >= minTime) {
+				break;
+			}
+			double factor = elapsed > 0 ? minTime / elapsed * 1.2 : 10;
+			iterations = std::max<long long>(iterations * 2, (long long)(iterations * factor));
+		}
+
+		std::vector<double> samples(repeats);
+		for (auto& sample : samples) {
+			sample = measure(iterations) / iterations * 1e9;
+		}
+		std::sort(samples.begin(), samples.end());
+		double median = samples[repeats / 2];
+		printf("%-48s %14.0f ns/op %12lld iters\n", name.c_str(), median, iterations);
+		return median;
+	}
+
+	/*
+	* @brief 生成倾斜刃边,灰度0.2~0.8
+	* @param[out] data 行优先的图像数据
+	* @param[in] width 宽度
+	* @param[in] height 高度
+	* @param[in] slope 每行偏移的列数
+	* @param[in] sigma 边缘的模糊程度(像素)
+	* @return void
+	*/
+	inline void slantedEdge(std::vector<double>& data, int width, int height, double slope, double sigma)
+	{
+		data.resize(width * height);
+		for (int y = 0; y < height; ++y) {
+			double edge = width / 2.0 + slope * (y - height / 2.0);
+			for (int x = 0; x < width; ++x) {
+				data[y * width + x] = 0.2 + 0.6 / (1 + std::exp(-(x + 0.5 - edge) / sigma));
+			}
+		}
+	}
+
+	//参数化名称,如 name/64x80
+	inline std::string name(const char* base, int width, int height)
+	{
+		return std::string(base) + "/" + std::to_string(width) + "x" + std::to_string(height);
+	}
+}
@@ -0,0 +1,127 @@
+#include "bench.h"
+#include "sfr.h"
+
+/*
+* 定位,计算和绘图的微基准,按区域尺寸参数化
+* 输入为sfr::Generator合成的梯形图卡,区域以中心图标为中心
+* 分通道计算同时输出与灰度计算的耗时比
+* 定义LIBSFR_ALLOC_STATS编译时额外输出预热后每帧的分配次数
+* 最后测量12MP倾斜棋盘格的全视场SFR分布
+* 用法: bench_algorithm [名称过滤]
+*/
+//倾斜棋盘格,4x4超采样后高斯模糊
+static cv::Mat slantedGrid(const cv::Size& size, int cell, double angle)
+{
+	const int n = 4;
+	double theta = angle * CV_PI / 180, c = std::cos(theta), s = std::sin(theta);
+	cv::Mat gray(size, CV_8UC1);
+	for (int y = 0; y < size.height; ++y) {
+		uchar* row = gray.ptr<uchar>(y);
+		for (int x = 0; x < size.width; ++x) {
+			int white = 0;
+			for (int i = 0; i < n * n; ++i) {
+				double px = x + (i % n + 0.5) / n, py = y + (i / n + 0.5) / n;
+				double u = px * c - py * s, v = px * s + py * c;
+				white += ((int)std::floor(u / cell) + (int)std::floor(v / cell)) & 1;
+			}
+			row[x] = cv::saturate_cast<uchar>(40 + 170.0 * white / (n * n));
+		}
+	}
+
+	cv::GaussianBlur(gray, gray, cv::Size(), 1.0);
+	cv::Mat bgr;
+	cv::cvtColor(gray, bgr, cv::COLOR_GRAY2BGR);
+	return bgr;
+}
+
+int main(int argc, char** argv)
+{
+	bench::Filter filter;
+	if (argc > 1) {
+		filter.pattern = argv[1];
+	}
+
+	const int sizes[] = { 200, 400, 800 };
+	for (int size : sizes) {
+		//图卡为区域的三倍大,中心图标半径为区域的四分之一
+		int radius = size / 4;
+		std::vector<cv::Point2f> centers;
+		sfr::Generator generator;
+		cv::Mat chart = generator.chart(cv::Size(size * 3, size * 3),
+			sfr::BLACK_TRAPEZOID_WITH_WHITE_BACKGROUND, radius, 70, &centers);
+		cv::Mat canvas = chart.clone();
+
+		//ROI取右下方块的左边缘
+		sfr::Area area[1];
+		area[0].x = (int)centers[0].x - size / 2;
+		area[0].y = (int)centers[0].y - size / 2;
+		area[0].width = size;
+		area[0].height = size;
+		area[0].locateType = sfr::BLACK_TRAPEZOID_WITH_WHITE_BACKGROUND;
+		area[0].roi.width = 40;
+		area[0].roi.height = 50;
+		area[0].roi.xOffset = -area[0].roi.width / 2;
+		area[0].roi.yOffset = radius / 2 - area[0].roi.height / 2;
+		area[0].denoisePixel = 5;
+
+		sfr::Data data;
+		sfr::Enable enable;
+		sfr::Algorithm algorithm;
+		algorithm.initialize(area, &data, &enable);
+		if (!algorithm.getCrossLineCenter(0, chart) || !algorithm.calculateRoi(0)) {
+			printf("locate failed on %dx%d chart\n", size, size);
+			continue;
+		}
+
+		bench::run(filter, bench::name("getCrossLineCenter", size, size), [&]() {
+			algorithm.getCrossLineCenter(0, chart);
+			});
+
+		double mono = bench::run(filter, bench::name("calculateSfr", size, size), [&]() {
+			algorithm.calculateSfr(0, chart);
+			});
+
+		sfr::Chroma chroma;
+		double color = bench::run(filter, bench::name("calculateChroma", size, size), [&]() {
+			algorithm.calculateChroma(0, chart, chroma);
+			});
+		if (mono > 0 && color > 0) {
+			printf("%-48s %14.2fx\n", bench::name("chroma/mono", size, size).c_str(), color / mono);
+		}
+
+		bench::run(filter, bench::name("putText", size, size), [&]() {
+			algorithm.calculateRoi(0);
+			algorithm.putText(0, canvas);
+			});
+
+		if (sfr::AllocScope::enabled()) {
+			const int frames = 100;
+			sfr::AllocScope::reset();
+			for (int i = 0; i < frames; ++i) {
+				algorithm.getCrossLineCenter(0, chart);
+				algorithm.calculateRoi(0);
+				algorithm.calculateSfr(0, chart);
+				algorithm.putText(0, canvas);
+				sfr::AllocScope::frame();
+			}
+
+			sfr::AllocStats stats;
+			sfr::AllocScope::snapshot(stats);
+			const char* stages[] = { "other", "locate", "sfr", "overlay" };
+			for (int i = 0; i < sfr::ALLOC_STAGE_SIZE; ++i) {
+				printf("%-48s %14.1f allocs/frame %12.0f bytes/frame\n",
+					bench::name((std::string("alloc/") + stages[i]).c_str(), size, size).c_str(),
+					(double)stats.count[i] / stats.frames, (double)stats.bytes[i] / stats.frames);
+			}
+		}
+	}
+
+	//全视场SFR分布,12MP倾斜5度的棋盘格,格子边长64像素
+	cv::Mat grid = slantedGrid(cv::Size(4000, 3000), 64, 5);
+	sfr::FieldMap field;
+	printf("field edges: %d\n", field.calculate(grid));
+	bench::run(filter, bench::name("FieldMap::calculate", grid.cols, grid.rows), [&]() {
+		field.calculate(grid);
+		}, 0.5, 3);
+	return 0;
+}
\ No newline at end of file
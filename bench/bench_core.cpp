@@ -0,0 +1,64 @@
+#include "bench.h"
+#include "mitre_sfr.h"
+
+/*
+* mitre_sfr各阶段的微基准,按ROI尺寸参数化
+* 用法: bench_core [名称过滤]
+*/
+int main(int argc, char** argv)
+{
+	bench::Filter filter;
+	if (argc > 1) {
+		filter.pattern = argv[1];
+	}
+
+	const int sizes[][2] = { { 32, 40 }, { 64, 80 }, { 128, 160 }, { 256, 320 } };
+	for (auto& size : sizes) {
+		int width = size[0], height = size[1];
+		int binLength = width * 4;
+
+		std::vector<double> roi;
+		bench::slantedEdge(roi, width, height, 0.1, 1.2);
+
+		//locate_centroids
+		std::vector<double> distances(height), shifts(height);
+		double centroid = 0;
+		bench::run(filter, bench::name("locate_centroids", width, height), [&]() {
+			locate_centroids(roi.data(), distances.data(), shifts.data(), width, height, &centroid);
+			});
+
+		//bin_to_regular_xgrid,像素到边缘的距离预先算好
+		std::vector<double> edgex(width * height), signal(roi), average(binLength);
+		std::vector<int> counts(binLength);
+		for (int y = 0; y < height; ++y) {
+			double shift = 0.1 * (y - height / 2.0);
+			for (int x = 0; x < width; ++x) {
+				edgex[y * width + x] = x - shift;
+			}
+		}
+		bench::run(filter, bench::name("bin_to_regular_xgrid", width, height), [&]() {
+			bin_to_regular_xgrid(4.0, edgex.data(), signal.data(), average.data(), counts.data(), width, height);
+			});
+
+		//discrete_fourier_transform,输入为汉明窗后的LSF长度
+		std::vector<double> lsf(binLength), spectrum(binLength / 2);
+		for (int i = 0; i < binLength; ++i) {
+			double x = (i - binLength / 2.0) / 4.0;
+			lsf[i] = std::exp(-x * x / 2);
+		}
+		bench::run(filter, bench::name("discrete_fourier_transform", width, height), [&]() {
+			discrete_fourier_transform(binLength, 1.0, lsf.data(), binLength / 2, 1.0 / binLength, spectrum.data());
+			});
+
+		//sfr_proc,iterate=1不改写输入,输出使用预分配内存
+		std::vector<double> frequency(binLength), sfr(binLength);
+		bench::run(filter, bench::name("sfr_proc", width, height), [&]() {
+			double* freq = frequency.data(), * value = sfr.data();
+			int length = 0, rows = height, cycles = 0, peak = 0;
+			double slope = 0, offset = 0, r2 = 0;
+			sfr_proc(&freq, &value, &length, roi.data(), width, &rows, &slope, &cycles,
+				&peak, &offset, &r2, 0, 1);
+			});
+	}
+	return 0;
+}
@@ -0,0 +1,289 @@
+#include "bench.h"
+#include "sfr.h"
+
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <fstream>
+#include <sstream>
+
+/*
+* 端到端吞吐与扩展性测试
+* 多个相机(每个相机一个Algorithm,五个区域)的帧由多个线程并发处理,
+* 同一相机的帧串行处理.输出每秒帧数,各阶段p50/p99延迟和并行效率(JSON).
+* 用法: bench_throughput [--cameras 1,2,4] [--threads 1,2,4,8] [--frames 200]
+*                        [--images 目录] [--save 目录] [--json 文件]
+* 图像集默认由sfr::Generator合成,--save保存后可用--images回放,回放的图像须为同一布局.
+*/
+
+//阶段
+enum Stage { LOCATE, ROI, SFR, TEXT, FRAME, STAGE_SIZE };
+static const char* STAGE_NAME[STAGE_SIZE] = { "getCrossLineCenter", "calculateRoi", "calculateSfr", "putText", "frame" };
+
+//图卡布局
+static const cv::Size CHART_SIZE(1600, 1200);
+static const int TARGET_RADIUS = 60;
+static const int AREA_SIZE = 300;
+
+//相机
+struct Camera {
+	sfr::Area area[sfr::MAX_AREA_SIZE];
+	sfr::Data data;
+	sfr::Enable enable;
+	sfr::Algorithm algorithm;
+	std::mutex mutex;
+};
+
+//一次运行的结果
+struct Result {
+	int cameras = 0;
+	int threads = 0;
+	int frames = 0;
+	double seconds = 0;
+	double fps = 0;
+	double efficiency = 0;
+	double p50[STAGE_SIZE] = {};
+	double p99[STAGE_SIZE] = {};
+};
+
+static std::vector<int> parseList(const std::string& text)
+{
+	std::vector<int> list;
+	std::stringstream stream(text);
+	std::string item;
+	while (std::getline(stream, item, ',')) {
+		if (!item.empty()) {
+			list.push_back(std::max<int>(std::stoi(item), 1));
+		}
+	}
+	return list;
+}
+
+static double percentile(std::vector<double>& samples, double p)
+{
+	if (samples.empty()) {
+		return 0;
+	}
+	size_t k = std::min<size_t>((size_t)(p * samples.size()), samples.size() - 1);
+	std::nth_element(samples.begin(), samples.begin() + k, samples.end());
+	return samples[k];
+}
+
+//合成图像集,各帧模糊与噪声种子不同
+static std::vector<cv::Mat> makeImages(std::vector<cv::Point2f>& centers)
+{
+	std::vector<cv::Mat> images;
+	for (int i = 0; i < 8; ++i) {
+		sfr::Synth synth;
+		synth.sigma = 0.6 + 0.15 * i;
+		synth.noise = 0.01;
+		synth.seed = 1000 + i;
+		images.push_back(sfr::Generator(synth).chart(CHART_SIZE,
+			sfr::BLACK_TRAPEZOID_WITH_WHITE_BACKGROUND, TARGET_RADIUS, 70, &centers));
+	}
+	return images;
+}
+
+static void setupCamera(Camera& camera, const std::vector<cv::Point2f>& centers)
+{
+	for (int i = 0; i < sfr::MAX_AREA_SIZE; ++i) {
+		auto& area = camera.area[i];
+		area.x = (int)centers[i].x - AREA_SIZE / 2;
+		area.y = (int)centers[i].y - AREA_SIZE / 2;
+		area.width = AREA_SIZE;
+		area.height = AREA_SIZE;
+		area.locateType = sfr::BLACK_TRAPEZOID_WITH_WHITE_BACKGROUND;
+		area.roi.width = 40;
+		area.roi.height = 50;
+		area.roi.xOffset = -area.roi.width / 2;
+		area.roi.yOffset = TARGET_RADIUS / 2 - area.roi.height / 2;
+		area.denoisePixel = 5;
+	}
+	camera.algorithm.initialize(camera.area, sfr::MAX_AREA_SIZE, &camera.data, &camera.enable);
+	//服务器上不绘制,只记录绘图命令
+	camera.algorithm.setOverlayMode(sfr::OVERLAY_DEFERRED);
+}
+
+static Result run(const std::vector<cv::Mat>& images, const std::vector<cv::Point2f>& centers,
+	int cameraCount, int threadCount, int frames)
+{
+	typedef std::chrono::steady_clock clock;
+	std::vector<std::unique_ptr<Camera>> cameras;
+	for (int i = 0; i < cameraCount; ++i) {
+		cameras.emplace_back(new Camera);
+		setupCamera(*cameras.back(), centers);
+	}
+
+	//每个线程单独记录,结束后合并
+	std::vector<std::vector<double>> samples[STAGE_SIZE];
+	for (auto& stage : samples) {
+		stage.resize(threadCount);
+	}
+
+	int total = frames * cameraCount;
+	std::atomic<int> next(0);
+	auto worker = [&](int thread) {
+		for (int k = next++; k < total; k = next++) {
+			auto& camera = *cameras[k % cameraCount];
+			//延迟绘制模式不写入图像,共享同一份数据
+			cv::Mat image = images[(k / cameraCount) % images.size()];
+			std::lock_guard<std::mutex> lock(camera.mutex);
+
+			double elapsed[STAGE_SIZE] = {};
+			auto frameStart = clock::now();
+			for (int i = 0; i < sfr::MAX_AREA_SIZE; ++i) {
+				auto start = clock::now();
+				bool located = camera.algorithm.getCrossLineCenter(i, image);
+				auto t1 = clock::now();
+				bool roi = located && camera.algorithm.calculateRoi(i);
+				auto t2 = clock::now();
+				if (roi) {
+					camera.algorithm.calculateSfr(i, image);
+				}
+				auto t3 = clock::now();
+				camera.algorithm.putText(i, image);
+				auto t4 = clock::now();
+				elapsed[LOCATE] += std::chrono::duration<double, std::micro>(t1 - start).count();
+				elapsed[ROI] += std::chrono::duration<double, std::micro>(t2 - t1).count();
+				elapsed[SFR] += std::chrono::duration<double, std::micro>(t3 - t2).count();
+				elapsed[TEXT] += std::chrono::duration<double, std::micro>(t4 - t3).count();
+			}
+			elapsed[FRAME] = std::chrono::duration<double, std::micro>(clock::now() - frameStart).count();
+			for (int s = 0; s < STAGE_SIZE; ++s) {
+				samples[s][thread].push_back(elapsed[s]);
+			}
+		}
+	};
+
+	auto start = clock::now();
+	std::vector<std::thread> threads;
+	for (int i = 0; i < threadCount; ++i) {
+		threads.emplace_back(worker, i);
+	}
+	for (auto& thread : threads) {
+		thread.join();
+	}
+
+	Result result;
+	result.cameras = cameraCount;
+	result.threads = threadCount;
+	result.frames = total;
+	result.seconds = std::chrono::duration<double>(clock::now() - start).count();
+	result.fps = total / result.seconds;
+	for (int s = 0; s < STAGE_SIZE; ++s) {
+		std::vector<double> merged;
+		for (auto& list : samples[s]) {
+			merged.insert(merged.end(), list.begin(), list.end());
+		}
+		result.p50[s] = percentile(merged, 0.50);
+		result.p99[s] = percentile(merged, 0.99);
+	}
+	return result;
+}
+
+static std::string toJson(const std::vector<Result>& results)
+{
+	std::ostringstream json;
+	json << "{\n  \"unit\": {\"latency\": \"us\", \"throughput\": \"frames/s\"},\n";
+	json << "  \"hardware_concurrency\": " << std::thread::hardware_concurrency() << ",\n";
+	json << "  \"runs\": [\n";
+	for (size_t i = 0; i < results.size(); ++i) {
+		auto& result = results[i];
+		json << "    {\"cameras\": " << result.cameras << ", \"threads\": " << result.threads
+			<< ", \"frames\": " << result.frames << ", \"seconds\": " << result.seconds
+			<< ", \"fps\": " << result.fps << ", \"efficiency\": " << result.efficiency
+			<< ", \"stages\": {";
+		for (int s = 0; s < STAGE_SIZE; ++s) {
+			json << (s ? ", " : "") << "\"" << STAGE_NAME[s] << "\": {\"p50\": " << result.p50[s]
+				<< ", \"p99\": " << result.p99[s] << "}";
+		}
+		json << "}}" << (i + 1 < results.size() ? "," : "") << "\n";
+	}
+	json << "  ]\n}\n";
+	return json.str();
+}
+
+int main(int argc, char** argv)
+{
+	std::vector<int> cameraList = { 1, 2, 4 };
+	std::vector<int> threadList = { 1, 2, 4, 8 };
+	int frames = 200;
+	std::string imageDir, saveDir, jsonFile;
+	for (int i = 1; i + 1 < argc; i += 2) {
+		std::string key = argv[i], value = argv[i + 1];
+		if (key == "--cameras") {
+			cameraList = parseList(value);
+		}
+		else if (key == "--threads") {
+			threadList = parseList(value);
+		}
+		else if (key == "--frames") {
+			frames = std::max<int>(std::stoi(value), 1);
+		}
+		else if (key == "--images") {
+			imageDir = value;
+		}
+		else if (key == "--save") {
+			saveDir = value;
+		}
+		else if (key == "--json") {
+			jsonFile = value;
+		}
+	}
+
+	std::vector<cv::Point2f> centers;
+	std::vector<cv::Mat> images = makeImages(centers);
+	if (!imageDir.empty()) {
+		std::vector<cv::String> files;
+		cv::glob(imageDir + "/*.png", files);
+		std::vector<cv::Mat> loaded;
+		for (auto& file : files) {
+			cv::Mat image = cv::imread(file);
+			if (image.size() == CHART_SIZE) {
+				loaded.push_back(image);
+			}
+		}
+
+		if (loaded.empty()) {
+			fprintf(stderr, "no %dx%d images in %s\n", CHART_SIZE.width, CHART_SIZE.height, imageDir.c_str());
+			return 1;
+		}
+		images = loaded;
+	}
+
+	if (!saveDir.empty()) {
+		for (size_t i = 0; i < images.size(); ++i) {
+			cv::imwrite(saveDir + "/chart_" + std::to_string(i) + ".png", images[i]);
+		}
+	}
+
+	//单线程作为并行效率的基准
+	if (std::find(threadList.begin(), threadList.end(), 1) == threadList.end()) {
+		threadList.insert(threadList.begin(), 1);
+	}
+	std::sort(threadList.begin(), threadList.end());
+
+	std::vector<Result> results;
+	for (int cameras : cameraList) {
+		double baseline = 0;
+		for (int threads : threadList) {
+			Result result = run(images, centers, cameras, threads, frames);
+			if (threads == 1) {
+				baseline = result.fps;
+			}
+			result.efficiency = baseline > 0 ? result.fps / (baseline * threads) : 0;
+			fprintf(stderr, "cameras %2d threads %2d  %8.1f frames/s  efficiency %.2f  frame p50 %.0fus p99 %.0fus\n",
+				cameras, threads, result.fps, result.efficiency, result.p50[FRAME], result.p99[FRAME]);
+			results.push_back(result);
+		}
+	}
+
+	std::string json = toJson(results);
+	if (jsonFile.empty()) {
+		printf("%s", json.c_str());
+	}
+	else {
+		std::ofstream(jsonFile) << json;
+	}
+	return 0;
+}
@@ -77,6 +77,16 @@ POSSIBILITY OF SUCH DAMAGE.
 static double sqrarg;
 #define SQR(a) ((sqrarg=(a)) == 0.0 ? 0.0: sqrarg*sqrarg)
 
+/* 临时缓冲区的分配函数,可替换为内存池 */
+static sfr_alloc_fn sfr_alloc = malloc;
+static sfr_free_fn sfr_free = free;
+
+void sfr_set_allocator(sfr_alloc_fn alloc, sfr_free_fn release)
+{
+	sfr_alloc = alloc ? alloc : malloc;
+	sfr_free = release ? release : free;
+}
+
 /*****************************************************************************/
 /* Data passed to this function is assumed to be radiometrically corrected,  */
 /* and oriented vertically, with black on left, white on right. The black to */
@@ -115,6 +125,32 @@ int sfr_proc(double** freq, double** sfr, int* len,
 	double* slope, int* numcycles, int* pcnt2,
 	double* off, double* r2,
 	int version, int iterate)
+{
+	sfr_fit fit = { 0 };
+	fit.cycles = *numcycles;
+
+	int err = sfr_proc_ex(freq, sfr, len, farea, size_x, nrows, &fit, pcnt2, version, iterate);
+	if (err == 0 || err == 3)
+	{
+		*slope = fit.slope;
+		*numcycles = fit.cycles;
+		*r2 = fit.r2;
+	}
+
+	if (err == 0)
+	{
+		*off = fit.offset;
+	}
+	return err;
+}
+
+/*****************************************************************************/
+/* Locate the edge and fit a line to the row centroids. On success fit->rows */
+/* holds the number of rows to use (an integer number of phase rotations).   */
+/* fit->cycles is an input as well: if > 0 it is kept as the cycle count.    */
+/* Returns 0 on success, otherwise the sfr_proc error code (1, 2 or 3).      */
+/*****************************************************************************/
+int sfr_edge_fit(const double* farea, int size_x, int size_y, int iterate, sfr_fit* fit)
 {
 	/* Verify input selection dimensions are EVEN */
 	if (size_x % 2 != 0)
@@ -123,120 +159,295 @@ int sfr_proc(double** freq, double** sfr, int* len,
 		return 1;
 	}
 
-	int i = 0, j = 0, size_y = *nrows;
-
 	//每行与中心行的距离
-	double* distance = (double*)malloc(size_y * sizeof(double));
+	double* distance = (double*)sfr_alloc(size_y * sizeof(double));
 
 	//每行质心与中心行质心的距离
-	double* shifts = (double*)malloc(size_y * sizeof(double));
+	double* shifts = (double*)sfr_alloc(size_y * sizeof(double));
 
-	double avar = 0, bvar = 0, offset1 = 0, offset2 = 0;
-	if (!locate_centroids(farea, distance, shifts, size_x, size_y, &offset1))
+	fit->rows = size_y;
+	if (!locate_centroids(farea, distance, shifts, size_x, size_y, &fit->centroid))
 	{
-		free(distance);
-		free(shifts);
+		sfr_free(distance);
+		sfr_free(shifts);
 		return 2;
 	}
 
 	/* Calculate the best fit line to the centroids */
-	linear_fitting(size_y, distance, shifts, slope, &offset2, r2, &avar, &bvar);
-	free(distance);
-
-	if (version)
-	{
-		PRINT("\nLinear Fit:  R2 = %.3f SE_intercept = %.2f  SE_angle = %.3f\n",
-			*r2, avar, atan(bvar) * (double)(180.0 / MITRE_PI));
-	}
+	linear_fitting(size_y, distance, shifts, &fit->slope, &fit->intercept, &fit->r2, &fit->avar, &fit->bvar);
+	sfr_free(distance);
+	sfr_free(shifts);
 
 	/* At least this many cycles required. */
 	/* For special iterative versions of the code, it can go lower */
 	double cycle_limit = iterate ? 1.0 : 5.0;
 
 	/* Check slope is OK, and set size_y to be full multiple of cycles */
-	if (!check_slope(*slope, &size_y, numcycles, cycle_limit, 1))
+	if (!check_slope(fit->slope, &fit->rows, &fit->cycles, cycle_limit, 1))
+	{
+		return 3;
+	}
+
+	/* On center row how much shift to get edge centered in row. */
+	/* offset = 0.;  Original code effectively used this (no centering)*/
+	fit->offset = fit->centroid + 0.5 + fit->intercept - (double)size_x / 2.0;
+	return 0;
+}
+
+int sfr_proc_ex(double** freq, double** sfr, int* len,
+	double* farea, int size_x, int* nrows,
+	sfr_fit* fit, int* pcnt2,
+	int version, int iterate)
+{
+	int err = sfr_edge_fit(farea, size_x, *nrows, iterate, fit);
+	if (err == 3)
 	{
-		free(shifts);
 		/* Slopes are bad. But send back enough data, so a diagnostic image has a chance. */
 		*pcnt2 = 2 * size_x;  /* Ignore derivative peak */
-		return 3;
 	}
 
+	if (err)
+	{
+		return err;
+	}
+
+	if (version)
+	{
+		PRINT("\nLinear Fit:  R2 = %.3f SE_intercept = %.2f  SE_angle = %.3f\n",
+			fit->r2, fit->avar, atan(fit->bvar) * (double)(180.0 / MITRE_PI));
+	}
+	return sfr_proc_fitted(freq, sfr, len, farea, size_x, nrows, fit, pcnt2, version, iterate);
+}
+
+int sfr_edge_verify(const double* farea, int size_x, int size_y, int samples,
+	double tolerance, sfr_fit* fit)
+{
+	int i = 0, k = 0;
+	if (size_x % 2 != 0)
+	{
+		return 1;
+	}
+
+	if (fit->rows <= 0 || fit->rows > size_y || samples < 2)
+	{
+		return 2;
+	}
+
+	/* 抽样行的质心与拟合直线的残差,首尾行必须检查 */
+	int half_y_size = size_y / 2;
+	double sum = 0;
+	for (k = 0; k < samples; ++k)
+	{
+		int j = (size_y - 1) * k / (samples - 1);
+		const double* row = farea + j * size_x;
+		double dt = 0, dt1 = 0;
+		for (i = 0; i < size_x - 1; ++i)
+		{
+			double temp = row[i + 1] - row[i];
+			dt += temp * (double)i;
+			dt1 += temp;
+		}
+
+		if (dt1 == 0)
+		{
+			return 2;
+		}
+
+		double shift = dt / dt1;
+		if (shift < 2 || size_x - shift < 2)
+		{
+			return 2;
+		}
+
+		double residual = shift - (fit->centroid + fit->intercept + fit->slope * (double)(j - half_y_size));
+		if (fabs(residual) > tolerance)
+		{
+			return 3;
+		}
+		sum += residual;
+	}
+
+	/* 斜率不变,按平均残差修正中心行质心 */
+	fit->centroid += sum / samples;
+	fit->offset = fit->centroid + 0.5 + fit->intercept - (double)size_x / 2.0;
+	return 0;
+}
+
+int sfr_proc_fitted(double** freq, double** sfr, int* len,
+	double* farea, int size_x, int* nrows,
+	const sfr_fit* fit, int* pcnt2,
+	int version, int iterate)
+{
+	int i = 0;
+
+	/* Allocate more memory */
+	int bin_len = (int)(ALPHA * size_x);
+	double* sums = (double*)sfr_alloc(bin_len * sizeof(double));
+	int* counts = (int*)sfr_alloc(bin_len * sizeof(int));
+	double* esf = (double*)sfr_alloc(bin_len * sizeof(double));
+	double* lsf = (double*)sfr_alloc(bin_len * sizeof(double));
+	for (i = 0; i < bin_len; ++i)
+	{
+		sums[i] = 0;
+		counts[i] = 0;
+	}
+
+	/* Project ESF(Edge Spread Function,边缘扩展函数) data into supersampled bins */
+	sfr_project(farea, size_x, *nrows, fit, version, sums, counts);
+
+	if (*freq == NULL)
+	{
+		*freq = (double*)malloc((bin_len / 2) * sizeof(double));
+	}
+
+	if (*sfr == NULL)
+	{
+		*sfr = (double*)malloc((bin_len / 2) * sizeof(double));
+	}
+
+	sfr_transform(sums, counts, size_x, version, esf, lsf, *sfr, len, pcnt2);
+	sfr_free(sums);
+	sfr_free(counts);
+
+	if (iterate == 0)
+	{
+		/* Copy ESF and LSF_w to output area */
+		for (i = 0; i < bin_len; ++i)
+		{
+			farea[i] = esf[i];
+			farea[size_x * (int)ALPHA + i] = lsf[i];
+		}
+	}
+	sfr_free(esf);
+	sfr_free(lsf);
+
+	for (i = 0; i < (*len); i++)
+	{
+		(*freq)[i] = (double)i / (double)size_x;
+	}
+
+	*nrows = fit->rows;
+	return 0;
+}
+
+/*****************************************************************************/
+/* Project the rows selected by sfr_edge_fit into size_x*ALPHA supersampled  */
+/* bins. sums and counts are accumulated, not cleared, so several ROIs of    */
+/* the same width can be summed before a single sfr_transform.               */
+/*****************************************************************************/
+void sfr_project(const double* farea, int size_x, int nrows, const sfr_fit* fit,
+	int version, double* sums, int* counts)
+{
+	int i = 0, j = 0;
+	int size_y = fit->rows;
+
 	/* Start image at new location, so that same row is center */
-	int center_row = *nrows / 2;
+	int center_row = nrows / 2;
 	int start_row = center_row - size_y / 2;
-	double* farea_old = farea;
 	farea = farea + start_row * size_x;
 
-	/* On center row how much shift to get edge centered in row. */
-	/* offset = 0.;  Original code effectively used this (no centering)*/
-	double offset = offset1 + 0.5 + offset2 - (double)size_x / 2.0;
-
-	*off = offset;
+	double offset = fit->offset;
 	if (version & ROUND || version & DER3)
 	{
 		offset += 0.125;
 	}
 
-	/* 
-	  reference the temp and shifts values to the new y center
+	/*
 	  Instead of using the values in shifts, synthesize new ones based on
-	  the best fit line.
+	  the best fit line, and bin each pixel directly at its distance from
+	  the edge.
 	*/
 	int col = size_y / 2;
-	for (i = 0; i < size_y; ++i)
+	int bin_len = size_x * (int)ALPHA;
+	for (j = 0; j < size_y; ++j)
 	{
-		shifts[i] = (*slope) * (double)(i - col) + offset;
+		double shift = fit->slope * (double)(j - col) + offset;
+		const double* row = farea + j * size_x;
+		for (i = 0; i < size_x; ++i)
+		{
+			int bin_number = (int)floor(ALPHA * ((double)i - shift));
+			if (bin_number >= 0 && bin_number <= bin_len - 1)
+			{
+				sums[bin_number] += row[i];
+				counts[bin_number] += 1;
+			}
+		}
 	}
+}
 
-	/* Don't normalize the data.  It gets normalized during dft process */
-	/* To normalize here, set dt = min and dt1 = max of farea data      */
-	double dt = 0.0, dt1 = 1.0;
+void sfr_project_channels(const double* farea, int size_x, int nrows, int channels,
+	const sfr_fit* fit, int version, double* sums, int* counts)
+{
+	int i = 0, j = 0, c = 0;
+	int size_y = fit->rows;
+
+	/* Same row selection and binning as sfr_project, pixels interleaved by channel */
+	int center_row = nrows / 2;
+	int start_row = center_row - size_y / 2;
+	farea = farea + start_row * size_x * channels;
+
+	double offset = fit->offset;
+	if (version & ROUND || version & DER3)
+	{
+		offset += 0.125;
+	}
 
-	double* edgex = (double*)malloc(size_y * size_x * sizeof(double));
-	double* signal = (double*)malloc(size_y * size_x * sizeof(double));
-	/* Calculate a long paired list of x values and signal values */
-	int pcnt = 0;
+	/* 各通道共用同一组区间计数,sums按通道依次存放 */
+	int col = size_y / 2;
+	int bin_len = size_x * (int)ALPHA;
 	for (j = 0; j < size_y; ++j)
 	{
+		double shift = fit->slope * (double)(j - col) + offset;
+		const double* row = farea + j * size_x * channels;
 		for (i = 0; i < size_x; ++i)
 		{
-			edgex[pcnt] = (double)i - shifts[j];
-			signal[pcnt] = (farea[j * size_x + i] - dt) / (dt1 - dt);
-			++pcnt;
+			int bin_number = (int)floor(ALPHA * ((double)i - shift));
+			if (bin_number >= 0 && bin_number <= bin_len - 1)
+			{
+				for (c = 0; c < channels; ++c)
+				{
+					sums[c * bin_len + bin_number] += row[i * channels + c];
+				}
+				counts[bin_number] += 1;
+			}
 		}
 	}
+}
 
-	free(shifts);
-
-	/* Allocate more memory */
+/*****************************************************************************/
+/* Turn accumulated ESF bins into the SFR: average the bins, differentiate,  */
+/* center and Hamming window the LSF and perform the DFT.                    */
+/*     Output: esf  = size_x*ALPHA averaged ESF values (may be NULL)         */
+/*             lsf  = size_x*ALPHA windowed LSF values (may be NULL)         */
+/*             sfr  = len normalized SFR values, len = size_x*ALPHA/2        */
+/*             pcnt2 = location of edge mid-point in oversample space        */
+/*     Returns the number of empty bins.                                     */
+/*****************************************************************************/
+int sfr_transform(const double* sums, const int* counts, int size_x, int version,
+	double* esf, double* lsf, double* sfr, int* len, int* pcnt2)
+{
+	int i = 0, pcnt = 0;
 	int bin_len = (int)(ALPHA * size_x);
-	double* AveEdge = (double*)malloc(bin_len * sizeof(double));
-	double* AveTmp = (double*)malloc(bin_len * sizeof(double));
-	int* counts = (long*)malloc(bin_len * sizeof(long));
-	/* Project ESF(Edge Spread Function,边缘扩展函数) data into supersampled bins */
-	int nzero = bin_to_regular_xgrid(ALPHA, edgex, signal, AveEdge, counts, size_x, size_y);
-	free(counts);
-	free(edgex);
-	free(signal);
+	double* AveEdge = (double*)sfr_alloc(bin_len * sizeof(double));
+	double* AveTmp = (double*)sfr_alloc(bin_len * sizeof(double));
+
+	int nzero = bin_normalize(sums, counts, AveEdge, bin_len);
 
 	double centroid = 0.0;
 	/* Compute LSF(LineSpread Function,线扩展函数) from ESF.  Not yet centered or windowed. */
 	calculate_derivative(bin_len, AveTmp, AveEdge, &centroid, version & DER3);
 
-	if (iterate == 0)
+	if (esf)
 	{
-		/* Copy ESF to output area */
 		for (i = 0; i < bin_len; ++i)
 		{
-			farea_old[i] = AveTmp[i];
+			esf[i] = AveTmp[i];
 		}
 	}
 
 	/* Find the peak/center of LSF */
 	locate_max_psf(bin_len, AveEdge, &pcnt);
 
-
 	if (version)
 	{
 		PRINT("Off center distance (1/4 pixel units): Peak %ld  Centroid %.2f\n",
@@ -252,21 +463,20 @@ int sfr_proc(double** freq, double** sfr, int* len,
 		PRINT("Shifting peak to center\n");
 	}
 
-	/* 
+	/*
 	Here the array length is shortened to ww_in_pixels*ALPHA,
-	and the LSF peak is centered and Hamming windowed. 
+	and the LSF peak is centered and Hamming windowed.
 	*/
 	apply_hamming_window((int)ALPHA, bin_len, size_x, AveEdge, &pcnt);
 
 	/* From now on this is the length used. */
 	*len = bin_len / 2;
 
-	if (iterate == 0)
+	if (lsf)
 	{
-		/* Copy LSF_w to output area */
-		for (i = 0; i < bin_len; i++)
+		for (i = 0; i < bin_len; ++i)
 		{
-			farea_old[size_x * (int)ALPHA + i] = AveEdge[i];
+			lsf[i] = AveEdge[i];
 		}
 	}
 
@@ -277,30 +487,78 @@ int sfr_proc(double** freq, double** sfr, int* len,
 	/* discrete_fourier_transform ( nx, dx, lsf(x), nf, df, sfr(f) ) */
 	discrete_fourier_transform(bin_len, tmp, AveEdge, *len, tmp2, AveTmp);
 
-	if (*freq == NULL)
+	for (i = 0; i < (*len); i++)
 	{
-		*freq = (double*)malloc((*len) * sizeof(double));
+		sfr[i] = AveTmp[i] / AveTmp[0];
 	}
 
-	if (*sfr == NULL)
+	/* Free */
+	sfr_free(AveEdge);
+	sfr_free(AveTmp);
+
+	*pcnt2 = pcnt;
+	return nzero;
+}
+
+/*****************************************************************************/
+/* sfr_transform for the per-channel bin planes of sfr_project_channels.     */
+/* Each channel is averaged, differentiated and windowed on its own, the DFT */
+/* evaluates every cos/sin once for all channels.                            */
+/*     Output: esf  = channels pointers to size_x*ALPHA ESF values           */
+/*                    (may be NULL, or hold NULL entries)                    */
+/*             sfr  = channels pointers to len normalized SFR values         */
+/*             pcnt2 = channels edge mid-points in oversample space          */
+/*     Returns the number of empty bins.                                     */
+/*****************************************************************************/
+int sfr_transform_channels(const double* sums, const int* counts, int size_x, int channels,
+	int version, double** esf, double** sfr, int* len, int* pcnt2)
+{
+	int i = 0, c = 0, nzero = 0;
+	int bin_len = (int)(ALPHA * size_x);
+	int ns = bin_len / 2;
+	double* AveEdge = (double*)sfr_alloc(channels * bin_len * sizeof(double));
+	double* AveTmp = (double*)sfr_alloc(bin_len * sizeof(double));
+	double* Dft = (double*)sfr_alloc(channels * ns * sizeof(double));
+
+	for (c = 0; c < channels; ++c)
 	{
-		*sfr = (double*)malloc((*len) * sizeof(double));
+		double* edge = AveEdge + c * bin_len;
+		int pcnt = 0;
+		double centroid = 0.0;
+		nzero = bin_normalize(sums + c * bin_len, counts, edge, bin_len);
+		calculate_derivative(bin_len, AveTmp, edge, &centroid, version & DER3);
+		if (esf && esf[c])
+		{
+			for (i = 0; i < bin_len; ++i)
+			{
+				esf[c][i] = AveTmp[i];
+			}
+		}
+
+		locate_max_psf(bin_len, edge, &pcnt);
+		if ((version & PEAK) == 0)
+		{
+			pcnt = bin_len / 2;
+		}
+		apply_hamming_window((int)ALPHA, bin_len, size_x, edge, &pcnt);
+		pcnt2[c] = pcnt;
 	}
 
-	for (i = 0; i < (*len); i++)
+	*len = ns;
+	discrete_fourier_transform_channels(bin_len, 1.0, AveEdge, channels, ns, 1.0 / (double)bin_len, Dft);
+	for (c = 0; c < channels; ++c)
 	{
-		(*freq)[i] = (double)i / (double)size_x;
-		(*sfr)[i] = AveTmp[i] / AveTmp[0];
+		const double* dft = Dft + c * ns;
+		for (i = 0; i < ns; i++)
+		{
+			sfr[c][i] = dft[i] / dft[0];
+		}
 	}
 
-	/* Free */
-	free(AveEdge);
-	free(AveTmp);
-
-	*nrows = size_y;
-	*pcnt2 = pcnt;
-
-	return 0;
+	sfr_free(AveEdge);
+	sfr_free(AveTmp);
+	sfr_free(Dft);
+	return nzero;
 }
 
 const char* get_version()
@@ -503,7 +761,7 @@ since each bin will be divided by counts at the end.
 int bin_to_regular_xgrid(double alpha, double* edgex, double* signal,
 	double* AveEdge, int* counts, int size_x, int size_y)
 {
-	int i, j, k, bin_number, bin_len;
+	int i, bin_number, bin_len;
 
 	bin_len = size_x * (int)alpha;
 
@@ -527,6 +785,25 @@ int bin_to_regular_xgrid(double alpha, double* edgex, double* signal,
 		}
 	}
 
+	return bin_normalize(AveEdge, counts, AveEdge, bin_len);
+}
+
+/*****************************************************************************/
+/* Divide the bin sums by their counts (see notes above for empty bins).     */
+/* sums and AveEdge may be the same array.                                   */
+/*****************************************************************************/
+int bin_normalize(const double* sums, const int* counts, double* AveEdge, int bin_len)
+{
+	int i, j, k;
+
+	if (sums != AveEdge)
+	{
+		for (i = 0; i < bin_len; ++i)
+		{
+			AveEdge[i] = sums[i];
+		}
+	}
+
 	int nzeros = 0;
 	for (i = 0; i < bin_len; ++i)
 	{
@@ -770,3 +1047,42 @@ void discrete_fourier_transform(int number, double dx, const double* lsf, int ns
 	return;
 }
 
+/*****************************************************************************/
+/* DFT magnitude of several LSFs stored one after another, number values    */
+/* each. The cos/sin of every term is shared by all channels.                */
+void discrete_fourier_transform_channels(int number, double dx, const double* lsf, int channels,
+	int ns, double ds, double* sfr)
+{
+	double a[4], b[4];
+	double twopi = 2.0 * MITRE_PI;
+	int j = 0, i = 0, c = 0, first = 0;
+	for (first = 0; first < channels; first += 4)
+	{
+		int count = channels - first < 4 ? channels - first : 4;
+		const double* x = lsf + first * number;
+		for (j = 0; j < ns; ++j)
+		{
+			double g = twopi * dx * ds * (double)j;
+			for (c = 0; c < count; ++c)
+			{
+				a[c] = 0;
+				b[c] = 0;
+			}
+			for (i = 0; i < number; ++i)
+			{
+				double cs = cos(g * (double)i), sn = sin(g * (double)i);
+				for (c = 0; c < count; ++c)
+				{
+					a[c] += x[c * number + i] * cs;
+					b[c] += x[c * number + i] * sn;
+				}
+			}
+			for (c = 0; c < count; ++c)
+			{
+				sfr[(first + c) * ns + j] = sqrt(a[c] * a[c] + b[c] * b[c]);
+			}
+		}
+	}
+	return;
+}
+
@@ -63,10 +63,33 @@ Code predominantly modified from IS 12233:2000 Annex A is in sfr_iso.c.
 #ifdef __cplusplus
 extern "C" {
 #endif
+	/* Edge fit statistics of one ROI */
+	typedef struct sfr_fit
+	{
+		double slope;      /* slope of the edge (columns per row) */
+		double offset;     /* shift to center edge in original rows */
+		double centroid;   /* centroid of the center row */
+		double intercept;  /* intercept of the fitted line */
+		double r2;         /* coefficient of determination of the fit */
+		double avar;       /* standard error of the intercept */
+		double bvar;       /* standard error of the slope */
+		int rows;          /* rows used after check_slope */
+		int cycles;        /* number of full periods included in SFR */
+	} sfr_fit;
+
+	/* Scratch allocator hooks, output arrays returned to the caller always use malloc.
+	 * The hooks are plain globals: set them once before any thread starts computing. */
+	typedef void* (*sfr_alloc_fn)(size_t size);
+	typedef void (*sfr_free_fn)(void* ptr);
+
+	void sfr_set_allocator(sfr_alloc_fn alloc, sfr_free_fn release);
+
 	const char* get_version();
 
 	void discrete_fourier_transform(int, double, const double*, int, double, double*);
 
+	void discrete_fourier_transform_channels(int, double, const double*, int, int, double, double*);
+
 	void apply_hamming_window(int, int, int, double*, int*);
 
 	void locate_max_psf(int, const double*, int*);
@@ -75,12 +98,48 @@ extern "C" {
 
 	int bin_to_regular_xgrid(double, double*, double*, double*, int*, int, int);
 
+	int bin_normalize(const double*, const int*, double*, int);
+
 	bool locate_centroids(const double*, double*, double*, int, int, double*);
 
 	void linear_fitting(int, const double*, const double*, double*, double*, double*, double*, double*);
 
 	bool check_slope(double, int*, int*, double, int);
 
+	int sfr_edge_fit(const double* farea, int size_x, int size_y, int iterate, sfr_fit* fit);
+
+	void sfr_project(const double* farea, int size_x, int nrows, const sfr_fit* fit,
+		int version, double* sums, int* counts);
+
+	void sfr_project_channels(const double* farea, int size_x, int nrows, int channels,
+		const sfr_fit* fit, int version, double* sums, int* counts);
+
+	int sfr_transform(const double* sums, const int* counts, int size_x, int version,
+		double* esf, double* lsf, double* sfr, int* len, int* pcnt2);
+
+	/*
+	* @brief sfr_project_channels的多通道区间转换为各通道的SFR,DFT的三角函数各通道共用
+	* @return 空区间数
+	*/
+	int sfr_transform_channels(const double* sums, const int* counts, int size_x, int channels,
+		int version, double** esf, double** sfr, int* len, int* pcnt2);
+
+	/*
+	* @brief 在抽样行上验证已有的边缘拟合,通过时修正质心与偏移
+	* @return 0通过,1宽度非偶数,2边缘丢失或靠近边界,3残差超过容差
+	*/
+	int sfr_edge_verify(const double* farea, int size_x, int size_y, int samples,
+		double tolerance, sfr_fit* fit);
+
+	/*
+	* @brief 使用已有的边缘拟合计算SFR,跳过质心定位与直线拟合
+	*/
+	int sfr_proc_fitted(double** freq, double** sfr, int* len, double* farea, int size_x,
+		int* nrows, const sfr_fit* fit, int* pcnt2, int version, int iterate);
+
+	int sfr_proc_ex(double** freq, double** sfr, int* len, double* farea, int size_x,
+		int* nrows, sfr_fit* fit, int* pcnt2, int version, int iterate);
+
 	int sfr_proc(double** freq, double** sfr, int* len, double* farea, int size_x,
 		int* nrows, double* slope, int* numcycles, int* pcnt2, double* off, double* r2,
 		int version, int iterate);
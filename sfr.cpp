@@ -1,6 +1,8 @@
 ﻿#include "sfr.h"
 #include "mitre_sfr.h"
 
+#include <chrono>
+
 int sfr::Area::_size = 0;
 
 #if defined(_WIN64)|| defined(__x86_64__)
@@ -16,6 +18,17 @@ sfr::Data::Data()
 	circum = 90;
 	interval = 10;
 	fovp = 50;
+	pixelSize = 0;
+	window = 10;
+	tolerance = 1.0;
+	confidence = 1.96;
+	changeThreshold = 0;
+	maxAge = 1000;
+	fitTolerance = 0.5;
+	bandRows = 256;
+	registerTolerance = 2.0;
+	probeCount = 1;
+	probeScale = 0.5;
 }
 
 sfr::Data::~Data()
@@ -29,6 +42,7 @@ sfr::Enable::Enable()
 	drawResultPass = true;
 	//drawFps = true;
 	drawFovp = true;
+	reuseFit = false;
 }
 
 sfr::Enable::~Enable()
@@ -79,6 +93,138 @@ sfr::Paint::~Paint()
 
 }
 
+sfr::Gate::Gate()
+{
+	step = 4;
+	darkLevel = 40;
+	saturationLevel = 250;
+	saturationRatio = 0.2;
+	minContrast = 30;
+	edgeRows = 5;
+	edgeMargin = 2;
+	maxEdgeWidth = 10;
+}
+
+sfr::Gate::~Gate()
+{
+
+}
+
+//抽样灰度,与CV_BGR2GRAY系数一致
+static inline int sampleGray(const cv::Mat& mat, int y, int x)
+{
+	if (mat.channels() == 1) {
+		return mat.ptr<uchar>(y)[x];
+	}
+	const uchar* p = mat.ptr<uchar>(y) + x * mat.channels();
+	return (p[0] * 1868 + p[1] * 9617 + p[2] * 4899 + 8192) >> 14;
+}
+
+/*
+* @brief 检查区域的亮度和对比度
+* @param[in] mat 区域图像
+* @param[in] gate 质量门限
+* @return int 参考Quality
+*/
+static int checkArea(const cv::Mat& mat, const sfr::Gate& gate)
+{
+	int step = std::max<int>(gate.step, 1);
+	int low = 255, high = 0, saturated = 0, total = 0;
+	for (int y = 0; y < mat.rows; y += step) {
+		for (int x = 0; x < mat.cols; x += step) {
+			int gray = sampleGray(mat, y, x);
+			low = std::min<int>(low, gray);
+			high = std::max<int>(high, gray);
+			saturated += gray >= gate.saturationLevel;
+			++total;
+		}
+	}
+
+	if (total == 0 || high < gate.darkLevel) {
+		return sfr::QUALITY_TOO_DARK;
+	}
+
+	if (saturated > total * gate.saturationRatio) {
+		return sfr::QUALITY_SATURATED;
+	}
+
+	if (high - low < gate.minContrast) {
+		return sfr::QUALITY_LOW_CONTRAST;
+	}
+	return sfr::QUALITY_OK;
+}
+
+/*
+* @brief 检查ROI内的边缘,抽样几行粗略估计边缘位置和宽度
+* @param[in] mat ROI图像
+* @param[in] gate 质量门限
+* @return int 参考Quality
+*/
+static int checkRoi(const cv::Mat& mat, const sfr::Gate& gate)
+{
+	int quality = checkArea(mat, gate);
+	if (quality != sfr::QUALITY_OK) {
+		return quality;
+	}
+
+	//首尾行必须检查,sfr_proc要求边缘在首尾行均远离边界
+	int rows = std::max<int>(gate.edgeRows, 2);
+	for (int i = 0; i < rows; ++i) {
+		int y = (mat.rows - 1) * i / (rows - 1);
+		int low = 255, high = 0;
+		for (int x = 0; x < mat.cols; ++x) {
+			int gray = sampleGray(mat, y, x);
+			low = std::min<int>(low, gray);
+			high = std::max<int>(high, gray);
+		}
+
+		if (high - low < gate.minContrast / 2) {
+			return sfr::QUALITY_EDGE_NOT_FOUND;
+		}
+
+		//过50%的位置即为边缘,左右方向均可
+		double middle = (low + high) / 2.0;
+		double level10 = low + (high - low) * 0.1, level90 = low + (high - low) * 0.9;
+		bool rising = sampleGray(mat, y, 0) < middle;
+		int edge = -1;
+		for (int x = 1; x < mat.cols && edge < 0; ++x) {
+			if ((sampleGray(mat, y, x) >= middle) == rising) {
+				edge = x;
+			}
+		}
+
+		if (edge < 0) {
+			return sfr::QUALITY_EDGE_NOT_FOUND;
+		}
+
+		if (edge < gate.edgeMargin || mat.cols - edge < gate.edgeMargin) {
+			return sfr::QUALITY_EDGE_NEAR_BORDER;
+		}
+
+		int left = edge, right = edge;
+		while (left > 0) {
+			int gray = sampleGray(mat, y, left - 1);
+			if (rising ? gray <= level10 : gray >= level90) {
+				break;
+			}
+			--left;
+		}
+
+		while (right < mat.cols - 1) {
+			int gray = sampleGray(mat, y, right);
+			if (rising ? gray >= level90 : gray <= level10) {
+				break;
+			}
+			++right;
+		}
+
+		if (right - left > gate.maxEdgeWidth) {
+			return sfr::QUALITY_BLURRED;
+		}
+	}
+	return sfr::QUALITY_OK;
+}
+
 double& sfr::Frequency::operator*()
 {
 	if (!_ptr0)
@@ -94,489 +240,1958 @@ double sfr::Frequency::total() const
 	return center + leftTop + rightTop + leftBottom + rightBottom;
 }
 
-void sfr::Area::startGrab(const std::function<void(int index, const cv::Mat& mat)>& func)
+sfr::Metrics::Metrics()
 {
-	std::lock_guard<std::mutex> lock(_mutex);
-	_grab = func;
+	mtf50 = 0;
+	mtf30 = 0;
+	mtf10 = 0;
+	mtf50lp = 0;
+	mtf30lp = 0;
+	mtf10lp = 0;
 }
 
-void sfr::Area::stopGrab()
+sfr::Metrics::~Metrics()
 {
-	std::lock_guard<std::mutex> lock(_mutex);
-	_grab = nullptr;
+
 }
 
-sfr::Algorithm::Algorithm()
+sfr::Curve::Curve()
 {
 
 }
 
-sfr::Algorithm::Algorithm(sfr::Area* area, sfr::Data* data, sfr::Enable* enable, sfr::Paint* paint)
+sfr::Curve::~Curve()
 {
-	initialize(area, data, enable, paint);
+
 }
 
-sfr::Algorithm::~Algorithm()
+void sfr::Curve::reserve(int capacity)
 {
+	if (capacity > (int)m_value.size()) {
+		m_value.resize(capacity);
+	}
+}
 
+double* sfr::Curve::buffer(int width, int size)
+{
+	reserve(size);
+	m_width = width;
+	m_size = size;
+	return m_value.data();
 }
 
-void sfr::Algorithm::initialize(sfr::Area* area, sfr::Data* data, sfr::Enable* enable, sfr::Paint* paint)
+void sfr::Curve::clear()
 {
-	m_data = data;
-	m_area = area;
-	m_enable = enable;
-	m_paint = paint;
-	for (int i = 0; i < sfr::Area::_size; ++i) {
-		m_area[i]._rect = cv::Rect(m_area[i].x, m_area[i].y, m_area[i].width, m_area[i].height);
-	}
+	m_size = 0;
+	m_width = 0;
 }
 
-bool sfr::Algorithm::isCalculate(int index)
+bool sfr::Curve::empty() const
 {
-	double tick = cv::getTickCount() / cv::getTickFrequency() * 1000;
-	if (tick >= m_area[index]._tick + m_data->interval)
-	{
-		m_area[index]._tick = tick;
-		return true;
-	}
-	return false;
+	return m_size == 0;
 }
 
-static bool findSectorCrossLine(std::vector<cv::Point2i>& coord, std::vector<cv::Point2i>& vec)
+int sfr::Curve::size() const
 {
-	if (coord.empty())
-	{
-		return false;
-	}
+	return m_size;
+}
 
-	const int interval = 5;
-	//前顶点
-	std::sort(coord.begin(), coord.end(), [](const cv::Point& a, const cv::Point& b) {return a.y < b.y; });
-	cv::Point topP = coord.at(0);
-	std::vector<int> topX;
-	for (auto& x : coord)
-	{
-		if (abs(x.y - topP.y) <= interval)
-		{
-			topX.push_back(x.x);
-		}
-	}
+int sfr::Curve::width() const
+{
+	return m_width;
+}
 
-	if (topX.empty())
-	{
-		return false;
-	}
+double sfr::Curve::frequency(int i) const
+{
+	return (double)i / (double)m_width;
+}
 
-	std::sort(topX.begin(), topX.end(), [](int a, int b) {return a > b; });
-	topP.x = topX.at(0);
-	vec.push_back(topP);
+double sfr::Curve::operator[](int i) const
+{
+	return m_value[i];
+}
 
-	//后顶点
-	std::sort(coord.begin(), coord.end(), [](const cv::Point& a, const cv::Point& b) {return a.y > b.y; });
-	cv::Point bottomP = coord.at(0);
-	std::vector<int> bottomX;
-	for (auto& x : coord)
-	{
-		if (abs(x.y - bottomP.y) <= interval)
-		{
-			bottomX.push_back(x.x);
-		}
-	}
+const double* sfr::Curve::data() const
+{
+	return m_value.data();
+}
 
-	if (bottomX.empty())
-	{
+bool sfr::Curve::find(double frequency, double& value) const
+{
+	if (m_size == 0 || frequency < 0) {
 		return false;
 	}
 
-	std::sort(bottomX.begin(), bottomX.end(), [](int a, int b) {return a < b; });
-	bottomP.x = bottomX.at(0);
-	vec.push_back(bottomP);
-
-	//左侧点
-	std::sort(coord.begin(), coord.end(), [](const cv::Point& a, const cv::Point& b) {return (a.x < b.x); });
-	cv::Point leftP = coord.at(0);
-	std::vector<int> leftY;
-	for (auto& x : coord)
-	{
-		if (abs(x.x - leftP.x) <= interval)
-		{
-			leftY.push_back(x.y);
-		}
+	int i = (int)std::floor(frequency * m_width + 0.5);
+	if (i >= m_size || std::abs(this->frequency(i) - frequency) > 0.000001) {
+		return false;
 	}
+	value = m_value[i];
+	return true;
+}
 
-	if (leftY.empty())
-	{
+bool sfr::Curve::interpolate(double frequency, double& value) const
+{
+	if (m_size == 0 || frequency < 0) {
 		return false;
 	}
 
-	std::sort(leftY.begin(), leftY.end(), [](int a, int b) {return a > b; });
-	leftP.y = leftY.at(0);
-	vec.push_back(leftP);
-
-	//右侧点
-	std::sort(coord.begin(), coord.end(), [](const cv::Point& a, const cv::Point& b) {return (a.x > b.x); });
-	cv::Point rightP = coord.at(0);
-	std::vector<int> rightY;
-	for (auto& x : coord)
-	{
-		if (abs(x.x - rightP.x) <= interval)
-		{
-			rightY.push_back(x.y);
+	double position = frequency * m_width;
+	int i = (int)std::floor(position);
+	if (i >= m_size - 1) {
+		//最后一个采样点
+		if (i == m_size - 1 && position - i <= 0.000001) {
+			value = m_value[i];
+			return true;
 		}
-	}
-
-	if (rightY.empty())
-	{
 		return false;
 	}
 
-	std::sort(rightY.begin(), rightY.end(), [](int a, int b) {return a < b; });
-	rightP.y = rightY.at(0);
-	vec.push_back(rightP);
+	double t = position - i;
+	value = m_value[i] + (m_value[i + 1] - m_value[i]) * t;
 	return true;
 }
 
-static bool findTrapezoidCrossLine(cv::Mat& img, std::vector<cv::Point2i>& coord, 
-	std::vector<cv::Point2i>& vec, int locateType)
+std::map<double, double> sfr::Curve::toMap() const
 {
-	if (coord.empty())
-	{
-		return false;
+	std::map<double, double> map;
+	for (int i = 0; i < m_size; ++i) {
+		map.insert(std::make_pair(frequency(i), m_value[i]));
 	}
+	return map;
+}
 
-	auto locateValue = locateType == sfr::BLACK_TRAPEZOID_WITH_WHITE_BACKGROUND ? 0x00 : 0xff;
-	//前顶点
-	std::sort(coord.begin(), coord.end(), [](const cv::Point& a, const cv::Point& b) {return a.y < b.y; });
-	cv::Point topP = coord.at(0);
-
-	//判断方向
-	int needToOffsetCount = 100, forwardOffsetCount = 0, reverseOffsetCount = 0;
-	for (int i = 0; i < needToOffsetCount; ++i) {
-		//黑色图形白底
-		auto offsetX = topP.x - i, offsetY = topP.y + i;
-		if (offsetX >= 0 && offsetY < img.rows - 1) {
-			auto pixmap = img.at<uchar>(offsetY, offsetX);
-			if (pixmap == locateValue) {
-				++forwardOffsetCount;
-			}
-			else {
-				++reverseOffsetCount;
-			}
+bool sfr::Curve::metrics(const double* frequencies, int count, double pixelSize, sfr::Metrics& metrics) const
+{
+	metrics.mtf50 = metrics.mtf30 = metrics.mtf10 = 0;
+	metrics.mtf50lp = metrics.mtf30lp = metrics.mtf10lp = 0;
+	metrics.values.resize(count);
+	for (int i = 0; i < count; ++i) {
+		if (!interpolate(frequencies[i], metrics.values[i])) {
+			metrics.values[i] = NAN;
 		}
 	}
 
-	//判断是否为正向
-	auto isForward = forwardOffsetCount > reverseOffsetCount;
-	//printf("is forward %d, forward count %d, reverse count %d\n", isForward, forwardOffsetCount, reverseOffsetCount);
-
-	int offsetCount = 0;
-	for (int i = 0; i < needToOffsetCount; ++i) {
-		//黑色图形白底
-		auto offsetX = 0, offsetY = 0;
-		if (isForward) {
-			offsetX = topP.x + i;
-			offsetY = topP.y + i;
-		}
-		else {
-			offsetX = topP.x - i;
-			offsetY = topP.y - i;
-		}
-
-		if (offsetX >= 0 && offsetX < img.cols - 1 &&
-			offsetY >= 0 && offsetY < img.rows - 1) {
-			if (img.at<uchar>(offsetY, offsetX) == locateValue) {
-				++offsetCount;
-			}
-		}
-	}
-	//printf("\n top offsetCount %d\n", offsetCount);
-	//修正x坐标到最精确坐标
-	if (isForward) {
-		topP.x += offsetCount;
-	}
-	else {
-		topP.x -= offsetCount;
+	if (m_size == 0) {
+		return false;
 	}
-	vec.push_back(topP);
-
-	//后顶点
-	std::sort(coord.begin(), coord.end(), [](const cv::Point& a, const cv::Point& b) {return a.y > b.y; });
-	cv::Point bottomP = coord.at(0);
-	offsetCount = 0;
-	for (int i = 0; i < needToOffsetCount; ++i) {
-		//黑色图形白底
-		auto offsetX = 0, offsetY = 0;
-		if (isForward) {
-			offsetX = bottomP.x - i;
-			offsetY = bottomP.y + i;
-		}
-		else {
-			offsetX = bottomP.x + i;
-			offsetY = bottomP.y + i;
-		}
 
-		if (offsetX >= 0 && offsetX < img.cols - 1 &&
-			offsetY >= 0 && offsetY < img.rows - 1) {
-			if (img.at<uchar>(offsetY, offsetX) == locateValue) {
-				++offsetCount;
-			}
+	//一次遍历,取曲线第一次下降穿越阈值的位置
+	const double level[] = { 0.5, 0.3, 0.1 };
+	double* result[] = { &metrics.mtf50, &metrics.mtf30, &metrics.mtf10 };
+	int n = 0;
+	for (int i = 0; i < m_size - 1 && n < 3; ++i) {
+		while (n < 3 && m_value[i] >= level[n] && m_value[i + 1] < level[n]) {
+			double t = (m_value[i] - level[n]) / (m_value[i] - m_value[i + 1]);
+			*result[n] = (i + t) / m_width;
+			++n;
 		}
 	}
-	//printf("\n bottom offsetCount %d\n", offsetCount);
-	if (isForward) {
-		bottomP.x -= offsetCount;
-	}
-	else {
-		bottomP.x += offsetCount;
+
+	if (pixelSize > 0) {
+		metrics.mtf50lp = metrics.mtf50 * 1000.0 / pixelSize;
+		metrics.mtf30lp = metrics.mtf30 * 1000.0 / pixelSize;
+		metrics.mtf10lp = metrics.mtf10 * 1000.0 / pixelSize;
 	}
-	vec.push_back(bottomP);
 	return true;
 }
 
-bool sfr::Algorithm::getCrossLineCenter(int index, const cv::Mat& source)
+sfr::Chroma::Chroma()
 {
-	m_area[index]._time = cv::getTickCount() / cv::getTickFrequency() * 1000;
-	cv::Mat src = source(m_area[index]._rect);
+	for (int i = 0; i < 3; ++i)
+	{
+		value[i] = 0;
+		offset[i] = 0;
+	}
+}
 
+sfr::Chroma::~Chroma()
+{
+
+}
+
+void sfr::Area::startGrab(const std::function<void(int index, const cv::Mat& mat)>& func)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	_grab = func;
+}
+
+void sfr::Area::stopGrab()
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	_grab = nullptr;
+}
+
+void sfr::Area::startTap(int capacity, bool roi)
+{
+	std::atomic_store(&_maskTap, std::make_shared<sfr::Tap>(capacity, cv::Size(width, height), CV_8UC1));
+	std::atomic_store(&_roiTap, roi ?
+		std::make_shared<sfr::Tap>(capacity, cv::Size(this->roi.width, this->roi.height), CV_8UC3) : nullptr);
+}
+
+void sfr::Area::stopTap()
+{
+	std::atomic_store(&_maskTap, std::shared_ptr<sfr::Tap>());
+	std::atomic_store(&_roiTap, std::shared_ptr<sfr::Tap>());
+}
+
+std::shared_ptr<sfr::Tap> sfr::Area::maskTap() const
+{
+	return std::atomic_load(&_maskTap);
+}
+
+std::shared_ptr<sfr::Tap> sfr::Area::roiTap() const
+{
+	return std::atomic_load(&_roiTap);
+}
+
+sfr::Tap::Frame::Frame(Slot* slot)
+	: m_slot(slot)
+{
+
+}
+
+sfr::Tap::Frame::Frame(Frame&& other) noexcept
+	: m_slot(other.m_slot)
+{
+	other.m_slot = nullptr;
+}
+
+sfr::Tap::Frame& sfr::Tap::Frame::operator=(Frame&& other) noexcept
+{
+	if (this != &other) {
+		release();
+		m_slot = other.m_slot;
+		other.m_slot = nullptr;
+	}
+	return *this;
+}
+
+sfr::Tap::Frame::~Frame()
+{
+	release();
+}
+
+bool sfr::Tap::Frame::empty() const
+{
+	return m_slot == nullptr;
+}
+
+const cv::Mat& sfr::Tap::Frame::mat() const
+{
+	static const cv::Mat empty;
+	return m_slot ? m_slot->mat : empty;
+}
+
+int sfr::Tap::Frame::index() const
+{
+	return m_slot ? m_slot->index : -1;
+}
+
+unsigned long long sfr::Tap::Frame::sequence() const
+{
+	return m_slot ? m_slot->sequence : 0;
+}
+
+double sfr::Tap::Frame::tick() const
+{
+	return m_slot ? m_slot->tick : 0;
+}
+
+void sfr::Tap::Frame::release()
+{
+	if (m_slot) {
+		m_slot->readers.fetch_sub(1);
+		m_slot = nullptr;
+	}
+}
+
+sfr::Tap::Tap(int capacity, const cv::Size& size, int type)
+{
+	m_capacity = std::max<int>(capacity, 2);
+	m_slot.reset(new Slot[m_capacity]);
+	for (int i = 0; i < m_capacity; ++i) {
+		if (size.width > 0 && size.height > 0) {
+			m_slot[i].mat.create(size, type);
+		}
+	}
+}
+
+sfr::Tap::~Tap()
+{
+
+}
+
+bool sfr::Tap::publish(int index, const cv::Mat& mat)
+{
+	//跳过最新的缓冲区和被读取端持有的缓冲区
+	int latest = m_latest.load();
+	for (int i = 1; i <= m_capacity; ++i) {
+		int n = (latest + i + m_capacity) % m_capacity;
+		if (n == latest || m_slot[n].readers.load() != 0) {
+			continue;
+		}
+
+		auto& slot = m_slot[n];
+		mat.copyTo(slot.mat);
+		slot.index = index;
+		slot.sequence = ++m_sequence;
+		slot.tick = cv::getTickCount() / cv::getTickFrequency() * 1000;
+		m_latest.store(n);
+		return true;
+	}
+	++m_dropped;
+	return false;
+}
+
+sfr::Tap::Frame sfr::Tap::acquire() const
+{
+	for (;;) {
+		int latest = m_latest.load();
+		if (latest < 0) {
+			return Frame();
+		}
+
+		//先占用再校验,发布端不会写入最新的缓冲区
+		auto& slot = m_slot[latest];
+		slot.readers.fetch_add(1);
+		if (m_latest.load() == latest) {
+			return Frame(&slot);
+		}
+		slot.readers.fetch_sub(1);
+	}
+}
+
+unsigned long long sfr::Tap::sequence() const
+{
+	return m_sequence.load();
+}
+
+unsigned long long sfr::Tap::dropped() const
+{
+	return m_dropped.load();
+}
+
+sfr::Algorithm::Algorithm()
+{
+
+}
+
+sfr::Algorithm::Algorithm(sfr::Area* area, sfr::Data* data, sfr::Enable* enable, sfr::Paint* paint)
+{
+	initialize(area, data, enable, paint);
+}
+
+sfr::Algorithm::~Algorithm()
+{
+
+}
+
+void sfr::Algorithm::initialize(sfr::Area* area, sfr::Data* data, sfr::Enable* enable, sfr::Paint* paint)
+{
+	initialize(area, sfr::Area::_size, data, enable, paint);
+}
+
+void sfr::Algorithm::initialize(sfr::Area* area, int size, sfr::Data* data, sfr::Enable* enable, sfr::Paint* paint)
+{
+	m_data = data;
+	m_area = area;
+	m_size = size;
+	m_enable = enable;
+	m_paint = paint;
+	sfr::AllocScope::installScratch();
+	for (int i = 0; i < m_size; ++i) {
+		m_area[i]._rect = cv::Rect(m_area[i].x, m_area[i].y, m_area[i].width, m_area[i].height);
+		//sfr_proc输出长度为ROI宽度的两倍
+		m_area[i]._curve.reserve(m_area[i].roi.width * 2);
+		m_area[i]._metrics.values.reserve(m_data->frequencies.size());
+		m_area[i]._estimator.reset(m_data->window);
+
+		auto& work = m_area[i]._work;
+		int width = m_area[i].width, height = m_area[i].height;
+		work.gray.create(height, width, CV_8UC1);
+		work.thr.create(height, width, CV_8UC1);
+		work.edge.create(height, width, CV_8UC1);
+		//边缘点数与区域周长成正比,目标像素数随图标大小变化,由首帧按需扩容后保持
+		work.coord.reserve(2 * (width + height));
+		work.vec.reserve(4);
+		work.values.reserve(std::max<int>(width, height) * 11);
+	}
+}
+
+//阶段计时,stop或析构时记入直方图
+class StageTimer {
+public:
+	explicit StageTimer(sfr::Histogram& histogram)
+		: m_histogram(&histogram), m_start(std::chrono::steady_clock::now())
+	{
+
+	}
+
+	//为nullptr时不计时
+	explicit StageTimer(sfr::Histogram* histogram)
+		: m_histogram(histogram), m_start(std::chrono::steady_clock::now())
+	{
+
+	}
+
+	~StageTimer()
+	{
+		stop();
+	}
+
+	void stop()
+	{
+		if (m_histogram) {
+			m_histogram->add(std::chrono::duration_cast<std::chrono::nanoseconds>(
+				std::chrono::steady_clock::now() - m_start).count());
+			m_histogram = nullptr;
+		}
+	}
+
+private:
+	sfr::Histogram* m_histogram;
+	std::chrono::steady_clock::time_point m_start;
+};
+
+//本帧定位到计算SFR的总耗时(ms),只累加上次putText之后执行过的阶段
+static double latency(const sfr::Area& area)
+{
+	double sum = 0;
+	for (int i = sfr::STAGE_PREPROCESS; i < sfr::STAGE_OVERLAY; ++i) {
+		if (area._timing[i].count() != area._drawn[i]) {
+			sum += area._timing[i].last();
+		}
+	}
+	return sum / 1000;
+}
+
+//putText之后记下各阶段的样本数,作为下一帧的起点
+static void markDrawn(sfr::Area& area)
+{
+	for (int i = 0; i < sfr::STAGE_SIZE; ++i) {
+		area._drawn[i] = area._timing[i].count();
+	}
+}
+
+void sfr::Algorithm::setGate(sfr::Gate* gate)
+{
+	m_gate = gate;
+}
+
+int sfr::Algorithm::quality(int index) const
+{
+	return m_area[index]._quality;
+}
+
+int sfr::Algorithm::reason(int index) const
+{
+	return m_area[index]._reason.load(std::memory_order_relaxed);
+}
+
+unsigned long long sfr::Algorithm::reasonCount(int index, int reason) const
+{
+	return m_area[index]._reasons[reason].load(std::memory_order_relaxed);
+}
+
+void sfr::Algorithm::resetReason(int index)
+{
+	for (auto& count : m_area[index]._reasons) {
+		count.store(0, std::memory_order_relaxed);
+	}
+}
+
+bool sfr::Algorithm::setReason(int index, int reason)
+{
+	auto& area = m_area[index];
+	area._reason.store(reason, std::memory_order_relaxed);
+	area._reasons[reason].fetch_add(1, std::memory_order_relaxed);
+	return reason == sfr::REASON_OK;
+}
+
+bool sfr::Algorithm::isCalculate(int index)
+{
+	double tick = cv::getTickCount() / cv::getTickFrequency() * 1000;
+	if (tick >= m_area[index]._tick + m_data->interval)
+	{
+		m_area[index]._tick = tick;
+		return true;
+	}
+	return false;
+}
+
+bool sfr::Algorithm::isCalculate(int index, const cv::Mat& source)
+{
+	if (!isCalculate(index))
+	{
+		return false;
+	}
+
+	auto& area = m_area[index];
+	if (m_data->changeThreshold <= 0)
+	{
+		return true;
+	}
+
+	//固定网格抽样作为区域指纹,与上次测量时的指纹比较
+	const int grid = 32;
+	cv::Mat src = source(area._rect);
+	auto& fingerprint = area._fingerprint;
+	if (fingerprint.size() == grid * grid && area._tick - area._measured < m_data->maxAge)
+	{
+		int sad = 0;
+		for (int i = 0, k = 0; i < grid; ++i)
+		{
+			int y = (src.rows - 1) * i / (grid - 1);
+			for (int j = 0; j < grid; ++j, ++k)
+			{
+				sad += std::abs(sampleGray(src, y, (src.cols - 1) * j / (grid - 1)) - fingerprint[k]);
+			}
+		}
+
+		if (sad < m_data->changeThreshold * grid * grid)
+		{
+			return false;
+		}
+	}
+
+	//测量成功后由commitFingerprint替换
+	auto& pending = area._pending;
+	pending.resize(grid * grid);
+	for (int i = 0, k = 0; i < grid; ++i)
+	{
+		int y = (src.rows - 1) * i / (grid - 1);
+		for (int j = 0; j < grid; ++j, ++k)
+		{
+			pending[k] = (uchar)sampleGray(src, y, (src.cols - 1) * j / (grid - 1));
+		}
+	}
+	area._pendingTick = area._tick;
+	return true;
+}
+
+//测量成功时isCalculate取得的指纹作为之后比较的基准,失败时清除基准,下一帧必定重新测量
+static void commitFingerprint(sfr::Area& area, bool success)
+{
+	if (!success)
+	{
+		area._fingerprint.clear();
+	}
+	else if (area._pendingTick >= 0)
+	{
+		area._fingerprint.swap(area._pending);
+		area._measured = area._pendingTick;
+	}
+	area._pendingTick = -1;
+}
+
+static bool findSectorCrossLine(std::vector<cv::Point2i>& coord, std::vector<cv::Point2i>& vec,
+	std::vector<int>& values)
+{
+	if (coord.empty())
+	{
+		return false;
+	}
+
+	const int interval = 5;
+	//前顶点
+	std::sort(coord.begin(), coord.end(), [](const cv::Point& a, const cv::Point& b) {return a.y < b.y; });
+	cv::Point topP = coord.at(0);
+	auto& topX = values;
+	topX.clear();
+	for (auto& x : coord)
+	{
+		if (abs(x.y - topP.y) <= interval)
+		{
+			topX.push_back(x.x);
+		}
+	}
+
+	if (topX.empty())
+	{
+		return false;
+	}
+
+	std::sort(topX.begin(), topX.end(), [](int a, int b) {return a > b; });
+	topP.x = topX.at(0);
+	vec.push_back(topP);
+
+	//后顶点
+	std::sort(coord.begin(), coord.end(), [](const cv::Point& a, const cv::Point& b) {return a.y > b.y; });
+	cv::Point bottomP = coord.at(0);
+	auto& bottomX = values;
+	bottomX.clear();
+	for (auto& x : coord)
+	{
+		if (abs(x.y - bottomP.y) <= interval)
+		{
+			bottomX.push_back(x.x);
+		}
+	}
+
+	if (bottomX.empty())
+	{
+		return false;
+	}
+
+	std::sort(bottomX.begin(), bottomX.end(), [](int a, int b) {return a < b; });
+	bottomP.x = bottomX.at(0);
+	vec.push_back(bottomP);
+
+	//左侧点
+	std::sort(coord.begin(), coord.end(), [](const cv::Point& a, const cv::Point& b) {return (a.x < b.x); });
+	cv::Point leftP = coord.at(0);
+	auto& leftY = values;
+	leftY.clear();
+	for (auto& x : coord)
+	{
+		if (abs(x.x - leftP.x) <= interval)
+		{
+			leftY.push_back(x.y);
+		}
+	}
+
+	if (leftY.empty())
+	{
+		return false;
+	}
+
+	std::sort(leftY.begin(), leftY.end(), [](int a, int b) {return a > b; });
+	leftP.y = leftY.at(0);
+	vec.push_back(leftP);
+
+	//右侧点
+	std::sort(coord.begin(), coord.end(), [](const cv::Point& a, const cv::Point& b) {return (a.x > b.x); });
+	cv::Point rightP = coord.at(0);
+	auto& rightY = values;
+	rightY.clear();
+	for (auto& x : coord)
+	{
+		if (abs(x.x - rightP.x) <= interval)
+		{
+			rightY.push_back(x.y);
+		}
+	}
+
+	if (rightY.empty())
+	{
+		return false;
+	}
+
+	std::sort(rightY.begin(), rightY.end(), [](int a, int b) {return a < b; });
+	rightP.y = rightY.at(0);
+	vec.push_back(rightP);
+	return true;
+}
+
+static bool findTrapezoidCrossLine(cv::Mat& img, std::vector<cv::Point2i>& coord, 
+	std::vector<cv::Point2i>& vec, int locateType)
+{
+	if (coord.empty())
+	{
+		return false;
+	}
+
+	auto locateValue = locateType == sfr::BLACK_TRAPEZOID_WITH_WHITE_BACKGROUND ? 0x00 : 0xff;
+	//前顶点
+	std::sort(coord.begin(), coord.end(), [](const cv::Point& a, const cv::Point& b) {return a.y < b.y; });
+	cv::Point topP = coord.at(0);
+
+	//判断方向
+	int needToOffsetCount = 100, forwardOffsetCount = 0, reverseOffsetCount = 0;
+	for (int i = 0; i < needToOffsetCount; ++i) {
+		//黑色图形白底
+		auto offsetX = topP.x - i, offsetY = topP.y + i;
+		if (offsetX >= 0 && offsetY < img.rows - 1) {
+			auto pixmap = img.at<uchar>(offsetY, offsetX);
+			if (pixmap == locateValue) {
+				++forwardOffsetCount;
+			}
+			else {
+				++reverseOffsetCount;
+			}
+		}
+	}
+
+	//判断是否为正向
+	auto isForward = forwardOffsetCount > reverseOffsetCount;
+	//printf("is forward %d, forward count %d, reverse count %d\n", isForward, forwardOffsetCount, reverseOffsetCount);
+
+	int offsetCount = 0;
+	for (int i = 0; i < needToOffsetCount; ++i) {
+		//黑色图形白底
+		auto offsetX = 0, offsetY = 0;
+		if (isForward) {
+			offsetX = topP.x + i;
+			offsetY = topP.y + i;
+		}
+		else {
+			offsetX = topP.x - i;
+			offsetY = topP.y - i;
+		}
+
+		if (offsetX >= 0 && offsetX < img.cols - 1 &&
+			offsetY >= 0 && offsetY < img.rows - 1) {
+			if (img.at<uchar>(offsetY, offsetX) == locateValue) {
+				++offsetCount;
+			}
+		}
+	}
+	//printf("\n top offsetCount %d\n", offsetCount);
+	//修正x坐标到最精确坐标
+	if (isForward) {
+		topP.x += offsetCount;
+	}
+	else {
+		topP.x -= offsetCount;
+	}
+	vec.push_back(topP);
+
+	//后顶点
+	std::sort(coord.begin(), coord.end(), [](const cv::Point& a, const cv::Point& b) {return a.y > b.y; });
+	cv::Point bottomP = coord.at(0);
+	offsetCount = 0;
+	for (int i = 0; i < needToOffsetCount; ++i) {
+		//黑色图形白底
+		auto offsetX = 0, offsetY = 0;
+		if (isForward) {
+			offsetX = bottomP.x - i;
+			offsetY = bottomP.y + i;
+		}
+		else {
+			offsetX = bottomP.x + i;
+			offsetY = bottomP.y + i;
+		}
+
+		if (offsetX >= 0 && offsetX < img.cols - 1 &&
+			offsetY >= 0 && offsetY < img.rows - 1) {
+			if (img.at<uchar>(offsetY, offsetX) == locateValue) {
+				++offsetCount;
+			}
+		}
+	}
+	//printf("\n bottom offsetCount %d\n", offsetCount);
+	if (isForward) {
+		bottomP.x -= offsetCount;
+	}
+	else {
+		bottomP.x += offsetCount;
+	}
+	vec.push_back(bottomP);
+	return true;
+}
+
+//定位滤波链(高斯5x5,开闭运算5x5,锐化3x3)的累计影响行数
+static const int FILTER_HALO = 2 + 4 + 4 + 1;
+
+//Canny(Sobel 3x3与非极大值抑制)的影响行数
+static const int CANNY_HALO = 2;
+
+//区域按bandRows划分的条带数,不超过线程数
+static int bandCount(int rows, int bandRows)
+{
+	if (bandRows <= 0 || rows < bandRows * 2) {
+		return 1;
+	}
+	return std::max(1, std::min(rows / bandRows, cv::getNumThreads()));
+}
+
+//按水平条带执行fn(band, y0, y1),只有一个条带时在当前线程执行
+template<typename Fn>
+static void forBands(int bands, int rows, const Fn& fn)
+{
+	if (bands <= 1) {
+		fn(0, 0, rows);
+		return;
+	}
+
+	cv::parallel_for_(cv::Range(0, bands), [&](const cv::Range& range) {
+		for (int band = range.start; band < range.end; ++band) {
+			fn(band, rows * band / bands, rows * (band + 1) / bands);
+		}
+		});
+}
+
+//定位的预处理滤波链,src原地修改,锐化结果写入thr
+static void filterChain(cv::Mat& src, cv::Mat& thr, double contrast, double brightness,
+	double threshold, int thresholdType)
+{
+	src.convertTo(src, -1, contrast, brightness);
+	cv::GaussianBlur(src, src, cv::Size(5, 5), 2);
+	cv::threshold(src, src, threshold, 255, thresholdType);
+
+	const int morph_size = 2;
+	static const cv::Mat element = cv::getStructuringElement(cv::MORPH_RECT,
+		cv::Size(2 * morph_size + 1, 2 * morph_size + 1),
+		cv::Point(morph_size, morph_size));
+	cv::morphologyEx(src, src, cv::MORPH_OPEN, element);
+	cv::morphologyEx(src, src, cv::MORPH_CLOSE, element);
+
+	// 定义锐化卷积核
+	static const cv::Mat kernel = (cv::Mat_<float>(3, 3) <<
+		0, -1, 0,
+		-1, 5, -1,
+		0, -1, 0);
+
+	// 使用卷积核进行锐化
+	cv::filter2D(src, thr, src.depth(), kernel);
+}
+
+//收集值为value的像素坐标,多条带时并行收集再按条带顺序合并,顺序与逐行扫描一致
+static void collectPoints(const cv::Mat& src, uchar value, int bands,
+	std::vector<sfr::Area::Tile>& tiles, std::vector<cv::Point>& points)
+{
+	points.clear();
+	forBands(bands, src.rows, [&](int band, int y0, int y1) {
+		auto& out = bands > 1 ? tiles[band].points : points;
+		out.clear();
+		for (int y = y0; y < y1; ++y) {
+			const uchar* row = src.ptr<uchar>(y);
+			for (int x = 0; x < src.cols; ++x) {
+				if (row[x] == value) {
+					out.push_back(cv::Point(x, y));
+				}
+			}
+		}
+		});
+
+	if (bands > 1) {
+		for (int band = 0; band < bands; ++band) {
+			points.insert(points.end(), tiles[band].points.begin(), tiles[band].points.end());
+		}
+	}
+}
+
+bool sfr::Algorithm::getCrossLineCenter(int index, const cv::Mat& source)
+{
+	sfr::AllocScope scope(sfr::ALLOC_LOCATE);
+	SFR_TRACE_SCOPE("locate");
+	StageTimer preprocess(m_area[index]._timing[sfr::STAGE_PREPROCESS]);
+	cv::Mat src = source(m_area[index]._rect);
+
+	//质量门限,在所有预处理之前
+	if (m_gate) {
+		m_area[index]._quality = checkArea(src, *m_gate);
+		if (m_area[index]._quality != sfr::QUALITY_OK) {
+			return setReason(index, m_area[index]._quality);
+		}
+	}
+
+	//定位成功只更新原因,成功次数在计算SFR时累计
+	m_area[index]._reason.store(sfr::REASON_OK, std::memory_order_relaxed);
 	if (m_area[index].locateType == sfr::SEARCH_AREA_CENTER_FIXED_POSTION) {
 		m_area[index]._point0 = cv::Point(src.cols / 2, src.rows / 2);
 		return true;
 	}
 
-	//图形是黑色并且为白底则为true,图形是白色并且为黑底则为false
-	auto locateType = m_area[index].locateType;
-	cv::cvtColor(src, src, CV_BGR2GRAY);
+	//图形是黑色并且为白底则为true,图形是白色并且为黑底则为false
+	auto locateType = m_area[index].locateType;
+	auto& work = m_area[index]._work;
+	cv::cvtColor(src, work.gray, cv::COLOR_BGR2GRAY);
+	src = work.gray;
+
+	auto thresholdType = 0, denoiseType = 0;
+	if (locateType == sfr::BLACK_SECTOR_WITH_WHITE_BACKGROUND ||
+		locateType == sfr::BLACK_TRAPEZOID_WITH_WHITE_BACKGROUND) {
+		thresholdType = cv::THRESH_BINARY;
+		denoiseType = 0;//消除黑色噪点
+	}
+	else if (locateType == sfr::WHITE_SECTOR_WITH_BLACK_BACKGROUND ||
+		locateType == sfr::WHITE_TRAPEZOID_WITH_BLACK_BACKGROUND) {
+		thresholdType = cv::THRESH_BINARY_INV;
+		denoiseType = 0xff;//消除白色噪点
+	}
+	else {
+		return setReason(index, sfr::REASON_LOCATE_TYPE);
+	}
+
+	//大区域按水平条带并行,结果与整幅处理逐像素一致
+	auto& area = m_area[index];
+	const int bands = bandCount(src.rows, m_data->bandRows);
+	auto& tiles = work.tiles;
+	if (tiles.size() < (size_t)bands) {
+		tiles.resize(bands);
+	}
+
+	//结果保留在thr中供梯形定位使用
+	cv::Mat& thr = work.thr;
+	if (bands > 1) {
+		thr.create(src.size(), CV_8UC1);
+		forBands(bands, src.rows, [&](int band, int y0, int y1) {
+			auto& tile = tiles[band];
+			int h0 = std::max(0, y0 - FILTER_HALO), h1 = std::min(src.rows, y1 + FILTER_HALO);
+			src.rowRange(h0, h1).copyTo(tile.src);
+			filterChain(tile.src, tile.thr, area.contrast, area.brightness, area.threshold, thresholdType);
+			cv::Mat dst = thr.rowRange(y0, y1);
+			tile.thr.rowRange(y0 - h0, y1 - h0).copyTo(dst);
+			});
+	}
+	else {
+		filterChain(src, thr, area.contrast, area.brightness, area.threshold, thresholdType);
+	}
+	thr.copyTo(src);
+
+	//cv::morphologyEx(src, src, cv::MORPH_GRADIENT, element);
+	//cv::medianBlur(src, src, 7);
+#ifdef _DEBUG
+	std::string name;
+	switch (index)
+	{
+	case 0:
+		name = "center";
+		break;
+	case 1:
+		name = "left_top";
+		break;
+	case 2:
+		name = "right_top";
+		break;
+	case 3:
+		name = "left_bottom";
+		break;
+	case 4:
+		name = "right_bottom";
+		break;
+	default:
+		break;
+	}
+	cv::imshow(name, src);
+	cv::waitKey(0);
+#endif // _DEBUG
+
+	int sum = (int)cv::sum(src)[0];
+	if (sum == 0 || (size_t)sum == src.total() * 255) {
+		//printf("too light or too dark\n");
+		return setReason(index, sfr::REASON_LOCATE_BRIGHTNESS);//图像光线太暗或太亮
+	}
+
+	auto& pixelVec = work.pixels;
+	collectPoints(src, (uchar)denoiseType, bands, tiles, pixelVec);
+
+	/* 边缘N个像素内消除噪点,原地修改且依赖扫描顺序,保持串行 */
+	const int edge = m_area[index].denoisePixel;
+	for (auto iter = pixelVec.begin(); iter != pixelVec.end(); ++iter) {
+		for (int pixmap = 0; pixmap < 5; ++pixmap) {
+			bool changeValue = false;
+			if ((src.at<uchar>(iter->y, iter->x) == denoiseType) &&
+				(((iter->x + pixmap < src.cols) && (src.at<uchar>(iter->y, iter->x + pixmap) != denoiseType)) &&
+					((iter->x - pixmap >= 0) && (src.at<uchar>(iter->y, iter->x - pixmap) != denoiseType)))) {
+				changeValue = true;
+			}
+
+			if ((src.at<uchar>(iter->y, iter->x) == 0) &&
+				((iter->y + pixmap < src.rows) && (src.at<uchar>(iter->y + pixmap, iter->x) != 0)) &&
+				((iter->y - pixmap >= 0) && (src.at<uchar>(iter->y - pixmap, iter->x) != 0))) {
+				changeValue = true;
+			}
+
+			if (iter->x < edge || iter->x + edge > src.cols) {
+				changeValue = true;
+			}
+
+			if (iter->y < edge || iter->y + edge > src.rows) {
+				changeValue = true;
+			}
+
+			if (changeValue) {
+				if (locateType == sfr::BLACK_SECTOR_WITH_WHITE_BACKGROUND ||
+					locateType == sfr::BLACK_TRAPEZOID_WITH_WHITE_BACKGROUND) {
+					src.at<uchar>(iter->y, iter->x) = 255;
+				}
+				else if (locateType == sfr::WHITE_SECTOR_WITH_BLACK_BACKGROUND ||
+					locateType == sfr::WHITE_TRAPEZOID_WITH_BLACK_BACKGROUND) {
+					src.at<uchar>(iter->y, iter->x) = 0;
+				}
+			}
+		}
+	}
+
+	forBands(bands, src.rows, [&](int, int y0, int y1) {
+		for (int i = y0; i < y1; ++i) {
+			for (int j = 0; j < src.cols; ++j) {
+				if (locateType == sfr::BLACK_SECTOR_WITH_WHITE_BACKGROUND ||
+					locateType == sfr::BLACK_TRAPEZOID_WITH_WHITE_BACKGROUND) {
+					if (src.at<uchar>(i, j) != 0) {
+						src.at<uchar>(i, j) = 0xff;
+					}
+				}
+				else if (locateType == sfr::WHITE_SECTOR_WITH_BLACK_BACKGROUND ||
+					locateType == sfr::WHITE_TRAPEZOID_WITH_BLACK_BACKGROUND) {
+					if (src.at<uchar>(i, j) != 0xff) {
+						src.at<uchar>(i, j) = 0;
+					}
+				}
+			}
+		}
+		});
 
-	auto thresholdType = 0, denoiseType = 0;
+	m_area[index]._mutex.lock();
+	if (m_area[index]._grab) {
+		m_area[index]._grab(index, src);
+	}
+	m_area[index]._mutex.unlock();
+
+	auto maskTap = std::atomic_load(&m_area[index]._maskTap);
+	if (maskTap) {
+		maskTap->publish(index, src);
+	}
+
+	preprocess.stop();
+	StageTimer locate(m_area[index]._timing[sfr::STAGE_LOCATE]);
 	if (locateType == sfr::BLACK_SECTOR_WITH_WHITE_BACKGROUND ||
 		locateType == sfr::BLACK_TRAPEZOID_WITH_WHITE_BACKGROUND) {
-		thresholdType = cv::THRESH_BINARY;
-		denoiseType = 0;//消除黑色噪点
+		if (bands > 1) {
+			//二值图的梯度均大于高阈值,滞后连接不跨越条带,halo覆盖Sobel与非极大值抑制即可
+			work.edge.create(src.size(), CV_8UC1);
+			forBands(bands, src.rows, [&](int band, int y0, int y1) {
+				auto& tile = tiles[band];
+				int h0 = std::max(0, y0 - CANNY_HALO), h1 = std::min(src.rows, y1 + CANNY_HALO);
+				src.rowRange(h0, h1).copyTo(tile.src);
+				cv::Canny(tile.src, tile.edge, 100, 250);
+				cv::Mat dst = work.edge.rowRange(y0, y1);
+				tile.edge.rowRange(y0 - h0, y1 - h0).copyTo(dst);
+				});
+		}
+		else {
+			cv::Canny(src, work.edge, 100, 250);
+		}
+		src = work.edge;
 	}
-	else if (locateType == sfr::WHITE_SECTOR_WITH_BLACK_BACKGROUND ||
+
+	auto& vec = work.vec, & coord = work.coord;
+	vec.clear();
+	collectPoints(src, 0xff, bands, tiles, coord);
+
+	if (locateType == sfr::BLACK_SECTOR_WITH_WHITE_BACKGROUND ||
+		locateType == sfr::WHITE_SECTOR_WITH_BLACK_BACKGROUND) {
+		if (!findSectorCrossLine(coord, vec, work.values)) {
+			return setReason(index, sfr::REASON_LOCATE_NO_EDGE);
+		}
+
+		if (!getCrossPoint(vec[0], vec[1], vec[2], vec[3], m_area[index]._point0)) {
+			return setReason(index, sfr::REASON_LOCATE_NO_CROSS);
+		}
+	}
+	else if (locateType == sfr::BLACK_TRAPEZOID_WITH_WHITE_BACKGROUND ||
 		locateType == sfr::WHITE_TRAPEZOID_WITH_BLACK_BACKGROUND) {
-		thresholdType = cv::THRESH_BINARY_INV;
-		denoiseType = 0xff;//消除白色噪点
+		if (!findTrapezoidCrossLine(thr, coord, vec, locateType)) {
+			return setReason(index, sfr::REASON_LOCATE_NO_EDGE);
+		}
+
+		//auto tmp = source(m_area[index]._rect);
+		//cv::circle(tmp, vec[0], 5, CV_RGB(255, 0, 0), 3);
+		//cv::circle(tmp, vec[1], 5, CV_RGB(255, 0, 0), 3);
+
+		cv::Point2i p2i;
+		p2i.x = (vec[0].x + vec[1].x) / 2;
+		p2i.y = (vec[0].y + vec[1].y) / 2;
+		m_area[index]._point0 = p2i;
 	}
-	else {
+
+	return true;
+}
+
+bool sfr::Algorithm::calculateRoi(int index, float threshold)
+{
+	SFR_TRACE_SCOPE("calculateRoi");
+	auto& area = m_area[index];
+	StageTimer timer(area._timing[sfr::STAGE_ROI]);
+
+	cv::Point2f&& p = area._point1 - area._point0;
+	if (std::abs(p.x) > threshold || std::abs(p.y) > threshold)
+		area._point1 = area._point0;
+	else
+		area._point0 = area._point1;
+
+	cv::Rect rect(int(area._point1.x + area.roi.xOffset),
+		int(area._point1.y + area.roi.yOffset),
+		area.roi.width, area.roi.height);
+	area._roi = rect;
+
+	area._roiOk = (area._roi.x > 0 && area._roi.y > 0) &&
+		((int)area._point1.x < area.width) &&
+		((int)area._point1.y < area.height);
+	if (!area._roiOk) {
+		setReason(index, sfr::REASON_ROI_OUT_OF_RANGE);
+	}
+	return area._roiOk;
+}
+
+//二值图一行内的边界点,x处与x-1处的值不同
+struct EdgePoint {
+	//边界位置
+	int x;
+
+	//同一行左侧相邻边界,没有时为0
+	int prev;
+
+	//同一行右侧相邻边界,没有时为行宽
+	int next;
+};
+
+//逐行跟踪的直边,rows从y0开始连续
+struct EdgeTrack {
+	int y0;
+	int polarity;
+	std::vector<EdgePoint> rows;
+};
+
+//逐行提取边界点,相同极性且与上一行预测位置相差不超过1.5像素的点连成直边
+static void trackEdges(const cv::Mat& mask, int minRows, std::vector<EdgeTrack>& tracks)
+{
+	std::vector<EdgeTrack> active, next;
+	std::vector<std::pair<int, int>> points;
+	std::vector<bool> claimed;
+	tracks.clear();
+	for (int y = 0; y <= mask.rows; ++y) {
+		points.clear();
+		if (y < mask.rows) {
+			const uchar* row = mask.ptr<uchar>(y);
+			for (int x = 1; x < mask.cols; ++x) {
+				if (row[x] != row[x - 1]) {
+					points.push_back({ x, row[x] > row[x - 1] ? 1 : -1 });
+				}
+			}
+		}
+
+		claimed.assign(points.size(), false);
+		next.clear();
+		for (auto& track : active) {
+			//用最近8行的斜率预测本行位置
+			int n = (int)track.rows.size(), k = std::min(n - 1, 8);
+			double predict = track.rows[n - 1].x;
+			if (k > 0) {
+				predict += double(track.rows[n - 1].x - track.rows[n - 1 - k].x) / k;
+			}
+
+			int best = -1;
+			double distance = 1.5;
+			for (size_t i = 0; i < points.size(); ++i) {
+				double d = std::abs(points[i].first - predict);
+				if (!claimed[i] && points[i].second == track.polarity && d <= distance) {
+					best = (int)i;
+					distance = d;
+				}
+			}
+
+			if (best < 0) {
+				if ((int)track.rows.size() >= minRows) {
+					tracks.push_back(std::move(track));
+				}
+				continue;
+			}
+
+			claimed[best] = true;
+			track.rows.push_back({ points[best].first,
+				best > 0 ? points[best - 1].first : 0,
+				best + 1 < (int)points.size() ? points[best + 1].first : mask.cols });
+			next.push_back(std::move(track));
+		}
+
+		for (size_t i = 0; i < points.size(); ++i) {
+			if (!claimed[i]) {
+				EdgeTrack track;
+				track.y0 = y;
+				track.polarity = points[i].second;
+				track.rows.push_back({ points[i].first,
+					i > 0 ? points[i - 1].first : 0,
+					i + 1 < points.size() ? points[i + 1].first : mask.cols });
+				next.push_back(std::move(track));
+			}
+		}
+		active.swap(next);
+	}
+}
+
+//直边两端靠近角点或圆弧,模糊使灰度偏离直边,ROI不使用的行数
+static const int ROI_END_ROWS = 4;
+
+//ROI与同一行相邻边界保持的列数,棋盘格等图卡上相邻的边经模糊后仍会影响ESF
+static const int ROI_GUARD = 3;
+
+/*
+* @brief 在直边上放置最大的ROI
+* ROI内每一行只能有这一条边界,边缘的水平漂移不超出左右余量,
+* 直边两端各留出ROI_END_ROWS行,左右与相邻边界留出ROI_GUARD列,
+* 斜率与行数必须通过check_slope(与sfr_edge_fit相同的周期下限)
+* @param[in] track 直边
+* @param[in] maxWidth ROI最大宽度
+* @param[in] maxHeight ROI最大高度
+* @param[out] roi ROI,相对于二值图
+* @return bool
+*/
+static bool placeRoi(const EdgeTrack& track, int maxWidth, int maxHeight, cv::Rect& roi)
+{
+	const int minSize = 16;
+
+	//x = a + b * (y - y0),b为每行的水平偏移,与sfr_fit的slope同义
+	double a = 0, b = 0;
+	auto fitLine = [&](int begin, int end) {
+		double sy = 0, sx = 0, syy = 0, sxy = 0, n = end - begin;
+		for (int i = begin; i < end; ++i) {
+			double x = track.rows[i].x - 0.5;
+			sy += i;
+			sx += x;
+			syy += (double)i * i;
+			sxy += i * x;
+		}
+		b = (n * sxy - sy * sx) / (n * syy - sy * sy);
+		a = (sx - b * sy) / n;
+	};
+
+	//边与圆弧等曲线相接处偏离直线,只保留残差不超过1.5像素的最长连续行
+	int first = 0, last = (int)track.rows.size();
+	for (int pass = 0; pass < 2; ++pass) {
+		fitLine(first, last);
+		int begin = first, runBegin = first, runEnd = first;
+		for (int i = first; i <= last; ++i) {
+			if (i == last || std::abs(track.rows[i].x - 0.5 - (a + b * i)) > 1.5) {
+				if (i - begin > runEnd - runBegin) {
+					runBegin = begin;
+					runEnd = i;
+				}
+				begin = i + 1;
+			}
+		}
+
+		first = runBegin;
+		last = runEnd;
+		if (last - first < minSize) {
+			//不是直边
+			return false;
+		}
+	}
+
+	first += ROI_END_ROWS;
+	last -= ROI_END_ROWS;
+	if (last - first < minSize) {
+		return false;
+	}
+	fitLine(first, last);
+
+	//一行内的最大空白决定ROI宽度上限
+	int freeWidth = 0;
+	for (int i = first; i < last; ++i) {
+		freeWidth = std::max(freeWidth, track.rows[i].next - track.rows[i].prev);
+	}
+
+	//宽度与中心行按比例步进,大区域上搜索量有界
+	long long best = 0;
+	int n = last - first;
+	int centerStep = std::max(4, n / 32);
+	for (int width = std::min(maxWidth, freeWidth) & ~1; width >= minSize;
+		width -= std::max(2, (width / 16) & ~1)) {
+		int margin = std::max(4, width / 6);
+		double drift = width / 2.0 - margin;
+		if (drift <= 0) {
+			continue;
+		}
+
+		int reach = std::abs(b) > 1e-6 ? (int)(drift / std::abs(b)) : n;
+		if ((long long)width * std::min(std::min(2 * reach + 1, n), maxHeight) <= best) {
+			//宽度递减,之后不可能更大
+			break;
+		}
+
+		for (int center = first; center < last; center += centerStep) {
+			int x0 = (int)std::floor(a + b * center + 0.5) - width / 2;
+			auto clean = [&](int i) {
+				auto& row = track.rows[i];
+				return x0 >= row.prev + ROI_GUARD && x0 + width + ROI_GUARD <= row.next && x0 >= 0 &&
+					std::abs(b * (i - center)) <= drift;
+			};
+
+			if (!clean(center)) {
+				continue;
+			}
+
+			int top = center, bottom = center;
+			while (bottom - top + 1 < maxHeight) {
+				if (top > first && center - top <= bottom - center && clean(top - 1)) {
+					--top;
+				}
+				else if (bottom + 1 < last && clean(bottom + 1)) {
+					++bottom;
+				}
+				else if (top > first && clean(top - 1)) {
+					--top;
+				}
+				else {
+					break;
+				}
+			}
+
+			int rows = bottom - top + 1, cycles = 0;
+			if (rows < minSize || !check_slope(b, &rows, &cycles, 1.0, 0) || rows < minSize) {
+				continue;
+			}
+
+			long long size = (long long)width * (bottom - top + 1);
+			if (size > best) {
+				best = size;
+				roi = cv::Rect(x0, track.y0 + top, width, bottom - top + 1);
+			}
+		}
+	}
+	return best > 0;
+}
+
+void sfr::Algorithm::findEdges(const cv::Mat& gray, int maxWidth, int maxHeight, std::vector<cv::Rect>& rois)
+{
+	rois.clear();
+	cv::Mat mask, sample;
+	cv::GaussianBlur(gray, mask, cv::Size(5, 5), 0);
+	cv::threshold(mask, mask, 0, 255, cv::THRESH_BINARY | cv::THRESH_OTSU);
+
+	std::vector<EdgeTrack> tracks;
+	trackEdges(mask, 16, tracks);
+
+	maxWidth = maxWidth > 0 ? std::min(maxWidth, gray.cols) : gray.cols;
+	maxHeight = maxHeight > 0 ? std::min(maxHeight, gray.rows) : gray.rows;
+	for (auto& track : tracks) {
+		cv::Rect roi;
+		if (!placeRoi(track, maxWidth, maxHeight, roi)) {
+			continue;
+		}
+
+		//与calculatesfr相同的输入,拟合失败的ROI不保留
+		gray(roi).convertTo(sample, CV_64FC1, 1.0 / 255.0);
+		sfr_fit edge = {};
+		if (sfr_edge_fit((const double*)sample.data, sample.cols, sample.rows, 1, &edge) == 0) {
+			rois.push_back(roi);
+		}
+	}
+
+	std::sort(rois.begin(), rois.end(), [](const cv::Rect& l, const cv::Rect& r) {
+		return l.area() > r.area();
+		});
+}
+
+bool sfr::Algorithm::detectRoi(int index, const cv::Mat& source)
+{
+	sfr::AllocScope scope(sfr::ALLOC_LOCATE);
+	SFR_TRACE_SCOPE("detectRoi");
+	auto& area = m_area[index];
+	StageTimer timer(area._timing[sfr::STAGE_ROI]);
+	auto& work = area._work;
+	cv::cvtColor(source(area._rect), work.gray, cv::COLOR_BGR2GRAY);
+
+	std::vector<cv::Rect> rois;
+	findEdges(work.gray, area.roi.width, area.roi.height, rois);
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	area._rois = rois;
+	area._roiOk = !rois.empty();
+	if (!area._roiOk) {
+		return setReason(index, sfr::REASON_ROI_NO_EDGE);
+	}
+	area._roi = rois[0];
+	return true;
+}
+
+int sfr::Algorithm::roiCount(int index)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return (int)m_area[index]._rois.size();
+}
+
+bool sfr::Algorithm::selectRoi(int index, int roi)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	auto& area = m_area[index];
+	if (roi < 0 || roi >= (int)area._rois.size()) {
+		return false;
+	}
+	area._roi = area._rois[roi];
+	area._roiOk = true;
+	return true;
+}
+
+//点集归一化到质心为原点,平均距离为sqrt(2),t为3x3相似变换
+static void normalizePoints(const std::vector<cv::Point2f>& points, double t[9])
+{
+	double cx = 0, cy = 0;
+	for (auto& p : points) {
+		cx += p.x;
+		cy += p.y;
+	}
+	cx /= points.size();
+	cy /= points.size();
+
+	double distance = 0;
+	for (auto& p : points) {
+		distance += std::hypot(p.x - cx, p.y - cy);
+	}
+	double scale = distance > 0 ? std::sqrt(2.0) * points.size() / distance : 1.0;
+	double m[9] = { scale, 0, -scale * cx, 0, scale, -scale * cy, 0, 0, 1 };
+	std::copy(m, m + 9, t);
+}
+
+static void multiply33(const double a[9], const double b[9], double c[9])
+{
+	for (int r = 0; r < 3; ++r) {
+		for (int k = 0; k < 3; ++k) {
+			c[r * 3 + k] = a[r * 3] * b[k] + a[r * 3 + 1] * b[3 + k] + a[r * 3 + 2] * b[6 + k];
+		}
+	}
+}
+
+//归一化DLT估计单应性矩阵,只依赖core模块
+static bool estimateHomography(const std::vector<cv::Point2f>& src,
+	const std::vector<cv::Point2f>& dst, cv::Mat& homography)
+{
+	int n = (int)src.size();
+	if (n < 4) {
+		return false;
+	}
+
+	double ts[9], td[9];
+	normalizePoints(src, ts);
+	normalizePoints(dst, td);
+	cv::Mat a(2 * n, 8, CV_64FC1), b(2 * n, 1, CV_64FC1), h;
+	for (int i = 0; i < n; ++i) {
+		double px = ts[0] * src[i].x + ts[2], py = ts[4] * src[i].y + ts[5];
+		double qx = td[0] * dst[i].x + td[2], qy = td[4] * dst[i].y + td[5];
+		double r0[8] = { px, py, 1, 0, 0, 0, -px * qx, -py * qx };
+		double r1[8] = { 0, 0, 0, px, py, 1, -px * qy, -py * qy };
+		std::copy(r0, r0 + 8, a.ptr<double>(2 * i));
+		std::copy(r1, r1 + 8, a.ptr<double>(2 * i + 1));
+		*b.ptr<double>(2 * i) = qx;
+		*b.ptr<double>(2 * i + 1) = qy;
+	}
+
+	if (!cv::solve(a, b, h, cv::DECOMP_SVD)) {
+		return false;
+	}
+
+	//H = Td^-1 * Hn * Ts
+	double hn[9], inv[9] = { 1 / td[0], 0, -td[2] / td[0], 0, 1 / td[4], -td[5] / td[4], 0, 0, 1 };
+	const double* v = h.ptr<double>();
+	std::copy(v, v + 8, hn);
+	hn[8] = 1;
+	double tmp[9], result[9];
+	multiply33(hn, ts, tmp);
+	multiply33(inv, tmp, result);
+	if (std::abs(result[8]) < 1e-12) {
 		return false;
 	}
 
-	src.convertTo(src, -1, m_area[index].contrast, m_area[index].brightness);
-	cv::GaussianBlur(src, src, cv::Size(5, 5), 2);
-	cv::threshold(src, src, m_area[index].threshold, 255, thresholdType);
+	homography.create(3, 3, CV_64FC1);
+	double* out = homography.ptr<double>();
+	for (int k = 0; k < 9; ++k) {
+		out[k] = result[k] / result[8];
+	}
+	return true;
+}
+
+static cv::Point2f projectPoint(const cv::Mat& homography, const cv::Point2f& point)
+{
+	const double* h = homography.ptr<double>();
+	double w = h[6] * point.x + h[7] * point.y + h[8];
+	return cv::Point2f(float((h[0] * point.x + h[1] * point.y + h[2]) / w),
+		float((h[3] * point.x + h[4] * point.y + h[5]) / w));
+}
+
+bool sfr::Algorithm::locateIn(int index, const cv::Mat& source, const cv::Rect& window, cv::Point2f& point)
+{
+	auto& area = m_area[index];
+	cv::Rect rect = area._rect;
+	area._rect = window & cv::Rect(0, 0, source.cols, source.rows);
+	bool result = !area._rect.empty() && getCrossLineCenter(index, source);
+	point = area._point0 + cv::Point2f((float)area._rect.x, (float)area._rect.y);
+	area._rect = rect;
+	return result;
+}
+
+bool sfr::Algorithm::fullRegister(const cv::Mat& source)
+{
+	m_homography.release();
+	std::vector<int> ids;
+	std::vector<cv::Point2f> src, dst;
+	for (int i = 0; i < m_size; ++i) {
+		if (m_area[i].locateType == sfr::SEARCH_AREA_CENTER_FIXED_POSTION) {
+			continue;
+		}
+
+		cv::Point2f point;
+		if (locateIn(i, source, m_area[i]._rect, point)) {
+			ids.push_back(i);
+			src.push_back(m_reference.empty() ? point : m_reference[i]);
+			dst.push_back(point);
+		}
+		else if (m_reference.empty()) {
+			//参考位置必须包含所有区域
+			return false;
+		}
+	}
+
+	if (m_reference.empty()) {
+		if (ids.size() < 4) {
+			return false;
+		}
+
+		m_reference.assign(m_size, cv::Point2f());
+		for (size_t k = 0; k < ids.size(); ++k) {
+			m_reference[ids[k]] = dst[k];
+		}
+	}
+
+	//最小二乘拟合,残差超过容差时逐个剔除最差的点,至少保留4个
+	cv::Mat homography;
+	double residual = 0;
+	while (true) {
+		if (!estimateHomography(src, dst, homography)) {
+			return false;
+		}
+
+		size_t worst = 0;
+		residual = 0;
+		for (size_t k = 0; k < src.size(); ++k) {
+			cv::Point2f d = projectPoint(homography, src[k]) - dst[k];
+			double error = std::hypot(d.x, d.y);
+			if (error > residual) {
+				residual = error;
+				worst = k;
+			}
+		}
+
+		if (residual <= m_data->registerTolerance || src.size() <= 4) {
+			break;
+		}
+		src.erase(src.begin() + worst);
+		dst.erase(dst.begin() + worst);
+	}
+
+	if (residual > m_data->registerTolerance) {
+		return false;
+	}
+
+	m_homography = homography;
+	m_residual = residual;
+	return true;
+}
+
+bool sfr::Algorithm::registerChart(const cv::Mat& source)
+{
+	sfr::AllocScope scope(sfr::ALLOC_LOCATE);
+	SFR_TRACE_SCOPE("registerChart");
+	bool verified = !m_homography.empty();
+	double residual = 0;
+	for (int k = 0; verified && k < m_data->probeCount; ++k) {
+		//轮流验证各区域
+		int index = -1;
+		for (int n = 0; n < m_size; ++n) {
+			int i = (m_probe + n) % m_size;
+			if (m_area[i].locateType != sfr::SEARCH_AREA_CENTER_FIXED_POSTION) {
+				index = i;
+				break;
+			}
+		}
+
+		if (index < 0) {
+			break;
+		}
+		m_probe = (index + 1) % m_size;
+
+		auto& area = m_area[index];
+		cv::Point2f predict = projectPoint(m_homography, m_reference[index]), point;
+		cv::Size size((int)(area._rect.width * m_data->probeScale), (int)(area._rect.height * m_data->probeScale));
+		cv::Rect window((int)predict.x - size.width / 2, (int)predict.y - size.height / 2, size.width, size.height);
+		if (!locateIn(index, source, window, point)) {
+			verified = false;
+			break;
+		}
+
+		cv::Point2f d = point - predict;
+		residual = std::max(residual, (double)std::hypot(d.x, d.y));
+		verified = residual <= m_data->registerTolerance;
+	}
+
+	if (verified) {
+		m_residual = residual;
+	}
+	else if (!fullRegister(source)) {
+		return false;
+	}
+
+	for (int i = 0; i < m_size; ++i) {
+		auto& area = m_area[i];
+		if (area.locateType != sfr::SEARCH_AREA_CENTER_FIXED_POSTION) {
+			area._point0 = projectPoint(m_homography, m_reference[i]) -
+				cv::Point2f((float)area._rect.x, (float)area._rect.y);
+		}
+		else {
+			area._point0 = cv::Point2f(area._rect.width / 2.0f, area._rect.height / 2.0f);
+		}
+	}
+	return true;
+}
+
+void sfr::Algorithm::resetRegistration()
+{
+	m_reference.clear();
+	m_homography.release();
+	m_residual = 0;
+	m_probe = 0;
+}
 
-	int morph_size = 2;
-	cv::Mat element = cv::getStructuringElement(cv::MORPH_RECT,
-		cv::Size(2 * morph_size + 1, 2 * morph_size + 1),
-		cv::Point(morph_size, morph_size));
-	cv::morphologyEx(src, src, cv::MORPH_OPEN, element);
-	cv::morphologyEx(src, src, cv::MORPH_CLOSE, element);
+cv::Mat sfr::Algorithm::homography() const
+{
+	return m_homography.clone();
+}
 
-	// 定义锐化卷积核
-	cv::Mat kernel = (cv::Mat_<float>(3, 3) <<
-		0, -1, 0,
-		-1, 5, -1,
-		0, -1, 0);
+double sfr::Algorithm::registrationResidual() const
+{
+	return m_residual;
+}
 
-	// 使用卷积核进行锐化
-	cv::filter2D(src, src, src.depth(), kernel);
+bool sfr::Algorithm::calculateSfr(int index, const cv::Mat& source)
+{
+	sfr::AllocScope scope(sfr::ALLOC_SFR);
+	SFR_TRACE_SCOPE("calculateSfr");
+	cv::Mat mat = source(m_area[index]._rect)(m_area[index]._roi);
+	auto roiTap = std::atomic_load(&m_area[index]._roiTap);
+	if (roiTap) {
+		roiTap->publish(index, mat);
+	}
 
-	//cv::morphologyEx(src, src, cv::MORPH_GRADIENT, element);
-	//cv::medianBlur(src, src, 7);
-	cv::Mat thr = src.clone();
-#ifdef _DEBUG
-	std::string name;
-	switch (index)
+	int quality = m_gate ? checkRoi(mat, *m_gate) : sfr::QUALITY_OK;
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_area[index]._quality = quality;
+	if (quality != sfr::QUALITY_OK) {
+		m_area[index]._value = 0;
+		m_area[index]._curve.clear();
+		m_area[index]._result = false;
+		commitFingerprint(m_area[index], false);
+		return setReason(index, quality);
+	}
+	auto& area = m_area[index];
+	int reason = sfr::REASON_OK;
+	area._result = calculatesfr(mat, area._value, &area._curve, &area._fit, &area._cacheFit, area._timing, &reason);
+	area._curve.metrics(m_data->frequencies.data(), (int)m_data->frequencies.size(),
+		m_data->pixelSize, area._metrics);
+	if (area._result) {
+		area._estimator.add(area._value);
+	}
+	commitFingerprint(area, area._result);
+	setReason(index, reason);
+	return area._result;
+}
+
+//sfr_edge_fit/sfr_proc的返回值转换为失败原因
+static int fitReason(int err)
+{
+	switch (err)
 	{
 	case 0:
-		name = "center";
-		break;
+		return sfr::REASON_OK;
 	case 1:
-		name = "left_top";
-		break;
+		return sfr::REASON_SFR_ODD_WIDTH;
 	case 2:
-		name = "right_top";
-		break;
-	case 3:
-		name = "left_bottom";
-		break;
-	case 4:
-		name = "right_bottom";
-		break;
+		return sfr::REASON_SFR_EDGE_NEAR_CORNER;
 	default:
-		break;
+		return sfr::REASON_SFR_BAD_SLOPE;
 	}
-	cv::imshow(name, src);
-	cv::waitKey(0);
-#endif // _DEBUG
+}
 
-	int sum = (int)cv::sum(src)[0];
-	if (sum == 0 || sum == src.total() * 255) {
-		//printf("too light or too dark\n");
-		return false;//图像光线太暗或太亮
-	}
+static void copyFit(const sfr_fit& edge, sfr::Fit& fit)
+{
+	fit.slope = edge.slope;
+	fit.angle = std::atan(edge.slope) * 180 / CV_PI;
+	fit.offset = edge.offset;
+	fit.centroid = edge.centroid;
+	fit.intercept = edge.intercept;
+	fit.r2 = edge.r2;
+	fit.avar = edge.avar;
+	fit.bvar = edge.bvar;
+	fit.rows = edge.rows;
+	fit.cycles = edge.cycles;
+}
 
-	std::vector<cv::Point> pixelVec;
-	for (int y = 0; y < src.rows; ++y) {
-		for (int x = 0; x < src.cols; ++x) {
-			if (src.at<uchar>(y, x) == denoiseType) {
-				pixelVec.push_back(cv::Point(x, y));
-			}
+static void copyFit(const sfr::Fit& fit, sfr_fit& edge)
+{
+	edge.slope = fit.slope;
+	edge.offset = fit.offset;
+	edge.centroid = fit.centroid;
+	edge.intercept = fit.intercept;
+	edge.r2 = fit.r2;
+	edge.avar = fit.avar;
+	edge.bvar = fit.bvar;
+	edge.rows = fit.rows;
+	edge.cycles = fit.cycles;
+}
+
+int sfr::Algorithm::calculateEdge(const cv::Mat& sample, const cv::Mat& color, bool fitted, sfr::Fit& fit,
+	double* sums, int* counts, sfr::Curve* curves, double** esf, sfr::Histogram* timing)
+{
+	const int cols = sample.cols, rows = sample.rows;
+	const int channels = color.empty() ? 1 : std::min(color.channels(), 4);
+	sfr_fit edge = {};
+	if (fitted) {
+		copyFit(fit, edge);
+	}
+	else {
+		StageTimer fitting(timing ? &timing[sfr::STAGE_FIT] : nullptr);
+		int err = sfr_edge_fit((const double*)sample.data, cols, rows, 1, &edge);
+		copyFit(edge, fit);
+		if (err) {
+			return err;
 		}
 	}
 
-	/* 边缘N个像素内消除噪点 */
-	const int edge = m_area[index].denoisePixel;
-	for (auto iter = pixelVec.begin(); iter != pixelVec.end(); ++iter) {
-		for (int pixmap = 0; pixmap < 5; ++pixmap) {
-			bool changeValue = false;
-			if ((src.at<uchar>(iter->y, iter->x) == denoiseType) &&
-				(((iter->x + pixmap < src.cols) && (src.at<uchar>(iter->y, iter->x + pixmap) != denoiseType)) &&
-					((iter->x - pixmap >= 0) && (src.at<uchar>(iter->y, iter->x - pixmap) != denoiseType)))) {
-				changeValue = true;
-			}
-
-			if ((src.at<uchar>(iter->y, iter->x) == 0) &&
-				((iter->y + pixmap < src.rows) && (src.at<uchar>(iter->y + pixmap, iter->x) != 0)) &&
-				((iter->y - pixmap >= 0) && (src.at<uchar>(iter->y - pixmap, iter->x) != 0))) {
-				changeValue = true;
-			}
-
-			if (iter->x < edge || iter->x + edge > src.cols) {
-				changeValue = true;
-			}
-
-			if (iter->y < edge || iter->y + edge > src.rows) {
-				changeValue = true;
-			}
-
-			if (changeValue) {
-				if (locateType == sfr::BLACK_SECTOR_WITH_WHITE_BACKGROUND ||
-					locateType == sfr::BLACK_TRAPEZOID_WITH_WHITE_BACKGROUND) {
-					src.at<uchar>(iter->y, iter->x) = 255;
-				}
-				else if (locateType == sfr::WHITE_SECTOR_WITH_BLACK_BACKGROUND ||
-					locateType == sfr::WHITE_TRAPEZOID_WITH_BLACK_BACKGROUND) {
-					src.at<uchar>(iter->y, iter->x) = 0;
-				}
-			}
-		}
+	//超采样区间长度为ROI宽度的四倍,各通道共用一次拟合
+	StageTimer project(timing ? &timing[sfr::STAGE_PROJECT] : nullptr);
+	if (channels == 1) {
+		sfr_project((const double*)sample.data, cols, rows, &edge, 0, sums, counts);
 	}
+	else {
+		sfr_project_channels((const double*)color.data, cols, rows, channels, &edge, 0, sums, counts);
+	}
+	project.stop();
 
-	for (int i = 0; i < src.rows; ++i) {
-		for (int j = 0; j < src.cols; ++j) {
-			if (locateType == sfr::BLACK_SECTOR_WITH_WHITE_BACKGROUND ||
-				locateType == sfr::BLACK_TRAPEZOID_WITH_WHITE_BACKGROUND) {
-				if (src.at<uchar>(i, j) != 0) {
-					src.at<uchar>(i, j) = 0xff;
-				}
-			}
-			else if (locateType == sfr::WHITE_SECTOR_WITH_BLACK_BACKGROUND ||
-				locateType == sfr::WHITE_TRAPEZOID_WITH_BLACK_BACKGROUND) {
-				if (src.at<uchar>(i, j) != 0xff) {
-					src.at<uchar>(i, j) = 0;
-				}
-			}
-		}
+	if (curves == nullptr) {
+		return 0;
 	}
 
-	m_area[index]._mutex.lock();
-	if (m_area[index]._grab) {
-		m_area[index]._grab(index, src);
+	//输出长度为ROI宽度的两倍,多通道时DFT的三角函数只计算一次
+	StageTimer transform(timing ? &timing[sfr::STAGE_TRANSFORM] : nullptr);
+	double* mtf[4] = {};
+	int size = 0, peak[4] = {};
+	for (int c = 0; c < channels; ++c) {
+		mtf[c] = curves[c].buffer(cols, cols * 2);
 	}
-	m_area[index]._mutex.unlock();
+	if (channels == 1) {
+		sfr_transform(sums, counts, cols, 0, esf ? esf[0] : nullptr, nullptr, mtf[0], &size, peak);
+	}
+	else {
+		sfr_transform_channels(sums, counts, cols, channels, 0, esf, mtf, &size, peak);
+	}
+	for (int c = 0; c < channels; ++c) {
+		curves[c].buffer(cols, size);
+	}
+	return 0;
+}
 
-	if (locateType == sfr::BLACK_SECTOR_WITH_WHITE_BACKGROUND ||
-		locateType == sfr::BLACK_TRAPEZOID_WITH_WHITE_BACKGROUND) {
-		cv::Canny(src, src, 100, 250);
+int sfr::Algorithm::accumulateSfr(int index, const cv::Mat& source, int frames)
+{
+	sfr::AllocScope scope(sfr::ALLOC_SFR);
+	SFR_TRACE_SCOPE("accumulateSfr");
+	cv::Mat roi = source(m_area[index]._rect)(m_area[index]._roi);
+	auto roiTap = std::atomic_load(&m_area[index]._roiTap);
+	if (roiTap) {
+		roiTap->publish(index, roi);
 	}
 
-	std::vector<cv::Point2i> vec, coord;
-	for (int y = 0; y < src.rows; ++y) {
-		for (int x = 0; x < src.cols; ++x) {
-			if (src.at<uchar>(y, x) == 0xff) {
-				coord.push_back(cv::Point(x, y));
-			}
-		}
+	int quality = m_gate ? checkRoi(roi, *m_gate) : sfr::QUALITY_OK;
+	std::lock_guard<std::mutex> lock(m_mutex);
+	auto& area = m_area[index];
+	area._quality = quality;
+	if (quality != sfr::QUALITY_OK) {
+		commitFingerprint(area, false);
+		setReason(index, quality);
+		return sfr::ACCUMULATE_FAILED;
 	}
 
-	bool result = true;
-	if (locateType == sfr::BLACK_SECTOR_WITH_WHITE_BACKGROUND ||
-		locateType == sfr::WHITE_SECTOR_WITH_BLACK_BACKGROUND) {
-		if (!findSectorCrossLine(coord, vec)) {
-			return false;
-		}
-		result = getCrossPoint(vec[0], vec[1], vec[2], vec[3], m_area[index]._point0);
+	auto& esf = area._esf;
+	StageTimer convert(area._timing[sfr::STAGE_CONVERT]);
+	cv::Mat& mat = m_sample;
+	cv::cvtColor(roi, m_gray, cv::COLOR_BGR2GRAY);
+	m_gray.convertTo(mat, CV_64FC1, 1.0 / 255.0);
+	convert.stop();
+
+	int cols = mat.cols, length = cols * 4;
+	if (esf.width != cols) {
+		esf.sums.assign(length, 0);
+		esf.counts.assign(length, 0);
+		esf.width = cols;
+		esf.frames = 0;
 	}
-	else if (locateType == sfr::BLACK_TRAPEZOID_WITH_WHITE_BACKGROUND ||
-		locateType == sfr::WHITE_TRAPEZOID_WITH_BLACK_BACKGROUND) {
-		if (!findTrapezoidCrossLine(thr, coord, vec, locateType)) {
-			return false;
-		}
 
-		//auto tmp = source(m_area[index]._rect);
-		//cv::circle(tmp, vec[0], 5, CV_RGB(255, 0, 0), 3);
-		//cv::circle(tmp, vec[1], 5, CV_RGB(255, 0, 0), 3);
+	//累加满frames帧时才变换
+	sfr::Fit edge;
+	bool last = esf.frames + 1 >= frames;
+	if (int err = calculateEdge(mat, cv::Mat(), false, edge, esf.sums.data(), esf.counts.data(),
+		last ? &area._curve : nullptr, nullptr, area._timing)) {
+		//此帧无效,不参与累加
+		commitFingerprint(area, false);
+		setReason(index, fitReason(err));
+		return sfr::ACCUMULATE_FAILED;
+	}
 
-		cv::Point2i p2i;
-		p2i.x = (vec[0].x + vec[1].x) / 2;
-		p2i.y = (vec[0].y + vec[1].y) / 2;
-		m_area[index]._point0 = p2i;
+	if (!last) {
+		++esf.frames;
+		return sfr::ACCUMULATE_PENDING;
 	}
 
-	return result;
+	std::fill(esf.sums.begin(), esf.sums.end(), 0.0);
+	std::fill(esf.counts.begin(), esf.counts.end(), 0);
+	esf.frames = 0;
+	area._fit = edge;
+
+	area._value = 0;
+	area._result = area._curve.interpolate(m_data->frequency, area._value);
+	area._value *= 100;
+	area._curve.metrics(m_data->frequencies.data(), (int)m_data->frequencies.size(),
+		m_data->pixelSize, area._metrics);
+	if (area._result) {
+		area._estimator.add(area._value);
+	}
+	commitFingerprint(area, area._result);
+	setReason(index, area._result ? sfr::REASON_OK : sfr::REASON_SFR_FREQUENCY);
+	return area._result ? sfr::ACCUMULATE_DONE : sfr::ACCUMULATE_FAILED;
 }
 
-bool sfr::Algorithm::calculateRoi(int index, float threshold)
+bool sfr::Algorithm::calculateChroma(int index, const cv::Mat& source, sfr::Chroma& chroma)
 {
+	sfr::AllocScope scope(sfr::ALLOC_SFR);
+	SFR_TRACE_SCOPE("calculateChroma");
+	cv::Mat roi = source(m_area[index]._rect)(m_area[index]._roi);
+	if (roi.channels() != 3) {
+		return false;
+	}
+
+	int quality = m_gate ? checkRoi(roi, *m_gate) : sfr::QUALITY_OK;
+	std::lock_guard<std::mutex> lock(m_mutex);
 	auto& area = m_area[index];
+	area._quality = quality;
+	if (quality != sfr::QUALITY_OK) {
+		commitFingerprint(area, false);
+		return setReason(index, quality);
+	}
 
-	cv::Point2f&& p = area._point1 - area._point0;
-	if (std::abs<float>(p.x) > threshold || std::abs<float>(p.y) > threshold)
-		area._point1 = area._point0;
-	else
-		area._point0 = area._point1;
+	//复用成员缓冲区,尺寸不变时不再分配
+	StageTimer convert(area._timing[sfr::STAGE_CONVERT]);
+	cv::cvtColor(roi, m_gray, cv::COLOR_BGR2GRAY);
+	m_gray.convertTo(m_sample, CV_64FC1, 1.0 / 255.0);
+	roi.convertTo(m_color, CV_64FC3, 1.0 / 255.0);
+	convert.stop();
+
+	//三个通道一起投影与变换,DFT的三角函数只计算一次
+	int cols = m_sample.cols, length = cols * 4;
+	m_sums.assign(length * 3, 0.0);
+	m_counts.assign(length, 0);
+	m_esf.resize(length * 3);
+	double* esf[3] = {};
+	for (int c = 0; c < 3; ++c) {
+		esf[c] = m_esf.data() + c * length;
+	}
+	if (int err = calculateEdge(m_sample, m_color, false, chroma.fit, m_sums.data(), m_counts.data(),
+		chroma.curve, esf, area._timing)) {
+		commitFingerprint(area, false);
+		return setReason(index, fitReason(err));
+	}
 
-	cv::Rect rect(int(area._point1.x + area.roi.xOffset),
-		int(area._point1.y + area.roi.yOffset),
-		area.roi.width, area.roi.height);
-	area._roi = rect;
+	bool result = true;
+	double centroid[3] = {};
+	for (int c = 0; c < 3; ++c) {
+		auto& curve = chroma.curve[c];
+
+		//ESF一阶差分的质心即边缘位置(超采样区间)
+		double moment = 0, total = 0;
+		for (int i = 0; i < length - 1; ++i) {
+			double diff = esf[c][i + 1] - esf[c][i];
+			moment += diff * i;
+			total += diff;
+		}
+		centroid[c] = total != 0 ? moment / total / 4 : 0;
 
-	area._roiOk = (area._roi.x > 0 && area._roi.y > 0) &&
-		((int)area._point1.x < area.width) &&
-		((int)area._point1.y < area.height);
-	return area._roiOk;
+		chroma.value[c] = 0;
+		result &= curve.interpolate(m_data->frequency, chroma.value[c]);
+		chroma.value[c] *= 100;
+	}
+
+	for (int c = 0; c < 3; ++c) {
+		chroma.offset[c] = centroid[c] - centroid[1];
+	}
+	commitFingerprint(area, result);
+	return setReason(index, result ? sfr::REASON_OK : sfr::REASON_SFR_FREQUENCY);
 }
 
-bool sfr::Algorithm::calculateSfr(int index, const cv::Mat& source)
+void sfr::Algorithm::resetAccumulate(int index)
 {
 	std::lock_guard<std::mutex> lock(m_mutex);
-	cv::Mat mat = source(m_area[index]._rect)(m_area[index]._roi);
-	m_area[index]._result = calculatesfr(mat, m_area[index]._value, &m_area[index]._curve);
-	return m_area[index]._result;
+	auto& esf = m_area[index]._esf;
+	std::fill(esf.sums.begin(), esf.sums.end(), 0.0);
+	std::fill(esf.counts.begin(), esf.counts.end(), 0);
+	esf.frames = 0;
 }
 
 void sfr::Algorithm::putText(int index, cv::Mat& source)
 {
+	sfr::AllocScope scope(sfr::ALLOC_OVERLAY);
+	SFR_TRACE_SCOPE("putText");
+	auto& area = m_area[index];
+	StageTimer timer(area._timing[sfr::STAGE_OVERLAY]);
+	if (m_overlayMode == OVERLAY_HEADLESS) {
+		area._roiOk = false;
+		markDrawn(area);
+		return;
+	}
+
+	//直接绘制时绑定图像源,延迟绘制时只记录命令
+	bool last = index == m_size - 1;
+	cv::Mat* target = m_overlayMode == OVERLAY_DIRECT ? &source : nullptr;
+	area._overlay.bind(target);
+	area._overlay.clear();
+	if (last) {
+		m_overlay.bind(target);
+		m_overlay.clear();
+	}
+
 	if (m_paint) {
 		putTextCustom(index, source);
 	}
 	else {
 		putTextDefault(index, source);
 	}
+
+	area._overlay.bind(nullptr);
+	if (last) {
+		m_overlay.bind(nullptr);
+	}
+	markDrawn(area);
+}
+
+void sfr::Algorithm::setOverlayMode(int mode)
+{
+	m_overlayMode = mode;
+	for (int i = 0; i < m_size; ++i) {
+		m_area[i]._overlay.clear();
+	}
+	m_overlay.clear();
+}
+
+int sfr::Algorithm::overlayMode() const
+{
+	return m_overlayMode;
+}
+
+void sfr::Algorithm::preview(const cv::Mat& source, cv::Mat& display, double scale)
+{
+	sfr::AllocScope scope(sfr::ALLOC_OVERLAY);
+	SFR_TRACE_SCOPE("preview");
+	if (scale == 1.0) {
+		source.copyTo(display);
+	}
+	else {
+		cv::resize(source, display, cv::Size(), scale, scale, cv::INTER_AREA);
+	}
+
+	for (int i = 0; i < m_size; ++i) {
+		m_area[i]._overlay.render(display, scale);
+	}
+	m_overlay.render(display, scale);
 }
 
 bool sfr::Algorithm::isPass() const
 {
 	int sum = 0;
-	for (int i = 0; i < std::min<int>(sfr::Area::_size, sfr::MAX_AREA_SIZE); ++i)
+	for (int i = 0; i < std::min<int>(m_size, sfr::MAX_AREA_SIZE); ++i)
 	{
 		if (m_area[i]._value >= (i ? m_data->circum : m_data->center))
 			sum++;
 	}
-	return sum == sfr::Area::_size;
+	return sum == m_size;
 }
 
 cv::Rect sfr::Algorithm::roi(int index) const
@@ -599,18 +2214,76 @@ bool sfr::Algorithm::result(int index)
 std::map<double, double> sfr::Algorithm::curve(int index)
 {
 	std::lock_guard<std::mutex> guard(m_mutex);
-	return m_area[index]._curve;
+	return m_area[index]._curve.toMap();
+}
+
+bool sfr::Algorithm::curve(int index, sfr::Curve& curve)
+{
+	std::lock_guard<std::mutex> guard(m_mutex);
+	curve = m_area[index]._curve;
+	return !curve.empty();
+}
+
+bool sfr::Algorithm::metrics(int index, sfr::Metrics& metrics)
+{
+	std::lock_guard<std::mutex> guard(m_mutex);
+	metrics = m_area[index]._metrics;
+	return m_area[index]._result;
+}
+
+bool sfr::Algorithm::fit(int index, sfr::Fit& fit)
+{
+	std::lock_guard<std::mutex> guard(m_mutex);
+	fit = m_area[index]._fit;
+	return m_area[index]._result;
+}
+
+bool sfr::Algorithm::estimate(int index, sfr::Estimate& estimate)
+{
+	std::lock_guard<std::mutex> guard(m_mutex);
+	m_area[index]._estimator.estimate(m_data->confidence, m_data->tolerance, estimate);
+	return estimate.stable;
+}
+
+bool sfr::Algorithm::isStable(int index)
+{
+	sfr::Estimate estimate;
+	return this->estimate(index, estimate);
+}
+
+void sfr::Algorithm::resetEstimate(int index)
+{
+	std::lock_guard<std::mutex> guard(m_mutex);
+	m_area[index]._estimator.clear();
+}
+
+double sfr::Algorithm::timing(int index, int stage, double p) const
+{
+	return m_area[index]._timing[stage].percentile(p);
+}
+
+const sfr::Histogram& sfr::Algorithm::histogram(int index, int stage) const
+{
+	return m_area[index]._timing[stage];
+}
+
+void sfr::Algorithm::resetTiming(int index)
+{
+	for (auto& timing : m_area[index]._timing) {
+		timing.reset();
+	}
+	markDrawn(m_area[index]);
 }
 
-void sfr::Algorithm::locateCenter(cv::Mat& img, const cv::Scalar& color, int thickness) const
+void sfr::Algorithm::locateCenter(sfr::Overlay& overlay, const cv::Size& size, const cv::Scalar& color, int thickness) const
 {
-	auto&& full = img.size();
-	auto&& half = img.size() / 2;
+	auto&& full = size;
+	auto&& half = size / 2;
 	cv::Point line1S(0, half.height), line1E(full.width, half.height);
 	cv::Point line2S(half.width, 0), line2E(half.width, full.height);
 
-	drawDottedLine(img, line1S, line1E, color, thickness);
-	drawDottedLine(img, line2S, line2E, color, thickness);
+	drawDottedLine(overlay, line1S, line1E, color, thickness);
+	drawDottedLine(overlay, line2S, line2E, color, thickness);
 }
 
 //int sfr::Algorithm::calculateFps()
@@ -661,68 +2334,89 @@ void sfr::Algorithm::locateCenter(cv::Mat& img, const cv::Scalar& color, int thi
 //	cv::putText(img, data, p, 1, fontScale, color, thickness);
 //}
 
-void sfr::Algorithm::drawFov(cv::Mat& img, const cv::Scalar& color, int thickness)
+void sfr::Algorithm::drawFov(sfr::Overlay& overlay, const cv::Size& size, const cv::Scalar& color, int thickness)
 {
-	double a = (double)img.cols / 2.0f;
-	double b = (double)img.rows / 2.0f;
+	double a = (double)size.width / 2.0f;
+	double b = (double)size.height / 2.0f;
 	double c = std::sqrt(std::pow(a, 2) + std::pow(b, 2));
 	c *= (m_data->fovp / 100.0f);
 	for (int i = 0; i < 60; i++)
 	{
-		cv::ellipse(img, cv::Point((int)a, (int)b), cv::Size((int)c, (int)c), 90, i * 6, i * 6 + 5, color);
+		overlay.ellipse(cv::Point((int)a, (int)b), cv::Size((int)c, (int)c), 90, i * 6, i * 6 + 5, color, thickness);
 	}
 }
 
 bool sfr::Algorithm::calculatesfr(const cv::Mat& area, double& value,
-	std::map<double, double>* curve)
+	sfr::Curve* curve, sfr::Fit* fit, sfr::Fit* cache, sfr::Histogram* timing, int* reason)
 {
+	SFR_TRACE_SCOPE("calculatesfr");
 	value = 0;
-	std::map<double, double> map;
-	cv::Mat mat = area.clone();
-	cv::cvtColor(mat, mat, CV_BGR2GRAY);
-	mat.convertTo(mat, CV_64FC1, 1.0 / 255.0);
-
-	double* freq = nullptr, * sfr = nullptr;
-	int size = 0, cols = mat.cols, rows = mat.rows;
-	int cycles = 0, peak = 0;
-	double slope = 0, offset = 0.0, r2 = 0.0;
-
-	int version = 0, iterate = 1;
-	if (sfr_proc(&freq, &sfr, &size, (double*)mat.data, cols, &rows,
-		&slope, &cycles, &peak, &offset, &r2, version, iterate))
+	if (curve == nullptr)
 	{
-		return false;
+		curve = &m_curve;
 	}
-	//printf("slope %.3lf angle %.3lf, offset %.3lf, r2 %.3lf\n", slope, std::atan(slope) * 180 / CV_PI, offset, r2);
-	for (int i = 0; i < size; ++i)
+	curve->clear();
+
+	//复用成员缓冲区,尺寸不变时不再分配
+	StageTimer convert(timing ? &timing[sfr::STAGE_CONVERT] : nullptr);
+	cv::Mat& mat = m_sample;
+	cv::cvtColor(area, m_gray, cv::COLOR_BGR2GRAY);
+	m_gray.convertTo(mat, CV_64FC1, 1.0 / 255.0);
+	convert.stop();
+
+	int cols = mat.cols, rows = mat.rows;
+	sfr::Fit edge;
+	bool fitted = false;
+	if (cache != nullptr && m_enable->reuseFit && cache->rows > 0)
 	{
-		map.insert(std::make_pair(freq[i], sfr[i]));
+		//ROI未移动时斜率基本不变,抽样几行验证通过即跳过质心定位与拟合
+		StageTimer verify(timing ? &timing[sfr::STAGE_FIT] : nullptr);
+		const int samples = 5;
+		sfr_fit probe = {};
+		copyFit(*cache, probe);
+		if (sfr_edge_verify((const double*)mat.data, cols, rows, samples, m_data->fitTolerance, &probe) == 0)
+		{
+			copyFit(probe, edge);
+			fitted = true;
+		}
 	}
 
-	if (curve != nullptr)
+	m_sums.assign(cols * 4, 0.0);
+	m_counts.assign(cols * 4, 0);
+	int err = calculateEdge(mat, cv::Mat(), fitted, edge, m_sums.data(), m_counts.data(), curve, nullptr, timing);
+	if (cache != nullptr)
 	{
-		*curve = map;
+		if (err == 0)
+		{
+			*cache = edge;
+		}
+		else
+		{
+			cache->rows = 0;
+		}
 	}
 
-	if (freq)
+	if (fit != nullptr)
 	{
-		free(freq);
+		*fit = edge;
 	}
 
-	if (sfr)
+	if (err)
 	{
-		free(sfr);
+		curve->clear();
+		if (reason != nullptr)
+		{
+			*reason = fitReason(err);
+		}
+		return false;
 	}
 
-	bool find = false;
-	for (const auto& x : map)
+	//频率不在采样点上时线性插值
+	bool find = curve->interpolate(m_data->frequency, value);
+	value *= 100;
+	if (reason != nullptr)
 	{
-		if (abs(x.first - m_data->frequency) <= 0.000001)
-		{
-			value = x.second * 100;
-			find = true;
-			break;
-		}
+		*reason = find ? sfr::REASON_OK : sfr::REASON_SFR_FREQUENCY;
 	}
 	return find;
 }
@@ -759,7 +2453,7 @@ bool sfr::Algorithm::getCrossPoint(const cv::Point2i& line1S, const cv::Point2i&
 	return false;
 }
 
-void sfr::Algorithm::drawPointLine(cv::Mat& img, cv::Point2f p1, cv::Point2f p2, const cv::Scalar& color, int thickness) const
+void sfr::Algorithm::drawPointLine(sfr::Overlay& overlay, cv::Point2f p1, cv::Point2f p2, const cv::Scalar& color, int thickness) const
 {
 	float n = 15; //虚点间隔
 	float w = p2.x - p1.x, h = p2.y - p1.y;
@@ -767,22 +2461,22 @@ void sfr::Algorithm::drawPointLine(cv::Mat& img, cv::Point2f p1, cv::Point2f p2,
 	int m = int(l / n);
 	n = l / m; // 矫正虚点间隔，使虚点数为整数
 
-	cv::circle(img, p1, 1, color, thickness); // 画起点
-	cv::circle(img, p2, 1, color, thickness); // 画终点
+	overlay.circle(p1, 1, color, thickness); // 画起点
+	overlay.circle(p2, 1, color, thickness); // 画终点
 	// 画中间点
 	if (p1.y == p2.y) // 水平线：y = m
 	{
 		float x1 = cv::min<float>(p1.x, p2.x);
 		float x2 = cv::max<float>(p1.x, p2.x);
 		for (float x = x1 + n; x < x2; x = x + n)
-			cv::circle(img, cv::Point2f(x, p1.y), 1, color, thickness);
+			overlay.circle(cv::Point2f(x, p1.y), 1, color, thickness);
 	}
 	else if (p1.x == p2.x) // 垂直线, x = m
 	{
 		float y1 = cv::min<float>(p1.y, p2.y);
 		float y2 = cv::max<float>(p1.y, p2.y);
 		for (float y = y1 + n; y < y2; y = y + n)
-			cv::circle(img, cv::Point2f(p1.x, y), 1, color, thickness);
+			overlay.circle(cv::Point2f(p1.x, y), 1, color, thickness);
 	}
 	else // 倾斜线，与x轴、y轴都不垂直或平行
 	{
@@ -792,12 +2486,12 @@ void sfr::Algorithm::drawPointLine(cv::Mat& img, cv::Point2f p1, cv::Point2f p2,
 		float x1 = cv::min<float>(p1.x, p2.x);
 		float x2 = cv::max<float>(p1.x, p2.x);
 		for (float x = x1 + m; x < x2; x = x + m)
-			cv::circle(img, cv::Point2f(x, k * (x - p1.x) + p1.y), 1, color, thickness);
+			overlay.circle(cv::Point2f(x, k * (x - p1.x) + p1.y), 1, color, thickness);
 	}
 	return;
 }
 
-void sfr::Algorithm::drawDottedLine(cv::Mat& img, cv::Point2f p1, cv::Point2f p2, const cv::Scalar& color, int thickness) const
+void sfr::Algorithm::drawDottedLine(sfr::Overlay& overlay, cv::Point2f p1, cv::Point2f p2, const cv::Scalar& color, int thickness) const
 {
 	float n = 15; //线长度
 	float w = p2.x - p1.x, h = p2.y - p1.y;
@@ -807,22 +2501,22 @@ void sfr::Algorithm::drawDottedLine(cv::Mat& img, cv::Point2f p1, cv::Point2f p2
 	m = m % 2 ? m : m + 1;
 	n = l / m;
 
-	cv::circle(img, p1, 1, color, thickness); // 画起点
-	cv::circle(img, p2, 1, color, thickness); // 画终点
+	overlay.circle(p1, 1, color, thickness); // 画起点
+	overlay.circle(p2, 1, color, thickness); // 画终点
 	// 画中间点
 	if (p1.y == p2.y) //水平线：y = m
 	{
 		float x1 = cv::min<float>(p1.x, p2.x);
 		float x2 = cv::max<float>(p1.x, p2.x);
 		for (float x = x1, n1 = 2 * n; x < x2; x = x + n1)
-			line(img, cv::Point2f(x, p1.y), cv::Point2f(x + n, p1.y), color, thickness);
+			overlay.line(cv::Point2f(x, p1.y), cv::Point2f(x + n, p1.y), color, thickness);
 	}
 	else if (p1.x == p2.x) //垂直线, x = m
 	{
 		float y1 = cv::min<float>(p1.y, p2.y);
 		float y2 = cv::max<float>(p1.y, p2.y);
 		for (float y = y1, n1 = 2 * n; y < y2; y = y + n1)
-			cv::line(img, cv::Point2f(p1.x, y), cv::Point2f(p1.x, y + n), color, thickness);
+			overlay.line(cv::Point2f(p1.x, y), cv::Point2f(p1.x, y + n), color, thickness);
 	}
 	else // 倾斜线，与x轴、y轴都不垂直或平行
 	{
@@ -835,25 +2529,64 @@ void sfr::Algorithm::drawDottedLine(cv::Mat& img, cv::Point2f p1, cv::Point2f p2
 		{
 			cv::Point p3 = cv::Point2f(x, k * (x - p1.x) + p1.y);
 			cv::Point p4 = cv::Point2f(x + n1, k * (x + n1 - p1.x) + p1.y);
-			cv::line(img, p3, p4, color, thickness);
+			overlay.line(p3, p4, color, thickness);
 		}
 	}
 	return;
 }
 
+void sfr::Algorithm::drawStaticLayer(const cv::Size& size, const cv::Scalar& centerColor, int centerThickness,
+	const cv::Scalar& fovColor, int fovThickness)
+{
+	auto& layer = m_layer;
+	if (layer.size != size || layer.centerColor != centerColor || layer.centerThickness != centerThickness ||
+		layer.fovColor != fovColor || layer.fovThickness != fovThickness || layer.fovp != m_data->fovp) {
+		layer.size = size;
+		layer.centerColor = centerColor;
+		layer.centerThickness = centerThickness;
+		layer.fovColor = fovColor;
+		layer.fovThickness = fovThickness;
+		layer.fovp = m_data->fovp;
+		//重新分配,已记录的延迟命令仍引用旧的掩码
+		layer.center = cv::Mat();
+		layer.fov = cv::Mat();
+	}
+
+	sfr::Overlay overlay;
+	if (m_enable->drawLocateCenter) {
+		if (layer.center.empty()) {
+			layer.center = cv::Mat::zeros(size, CV_8UC1);
+			overlay.bind(&layer.center);
+			locateCenter(overlay, size, cv::Scalar(0xff), centerThickness);
+		}
+		m_overlay.mask(layer.center, centerColor);
+	}
+
+	if (m_enable->drawFovp) {
+		if (layer.fov.empty()) {
+			layer.fov = cv::Mat::zeros(size, CV_8UC1);
+			overlay.bind(&layer.fov);
+			drawFov(overlay, size, cv::Scalar(0xff), fovThickness);
+		}
+		m_overlay.mask(layer.fov, fovColor);
+	}
+}
+
 void sfr::Algorithm::putTextDefault(int index, cv::Mat& source)
 {
 	auto& area = m_area[index];
-	cv::Mat roi = source(area._rect);
+	auto& overlay = area._overlay;
+	overlay.region(area._rect);
+	cv::Size roi = area._rect.size();
 
 	//画ROI矩形框
-	cv::rectangle(roi, cv::Rect(0, 0, roi.cols, roi.rows), CV_RGB(255, 255, 0), 2);
+	overlay.rectangle(cv::Rect(0, 0, roi.width, roi.height), CV_RGB(255, 255, 0), 2);
 
 	//画编号
 	cv::String&& number = "#" + std::to_string(index);
 	int baseLine = 0;
 	cv::Size&& size = cv::getTextSize(number, 1, 1.5, 2, &baseLine);
-	cv::putText(roi, number, cv::Point(0, size.height + baseLine), 1, 1.5, CV_RGB(0, 255, 255), 2);
+	overlay.putText(number, cv::Point(0, size.height + baseLine), 1, 1.5, CV_RGB(0, 255, 255), 2);
 
 	if (area._roiOk)
 	{
@@ -861,20 +2594,20 @@ void sfr::Algorithm::putTextDefault(int index, cv::Mat& source)
 
 		//画坐标
 		char coordinate[32] = { 0 };
-		sprintf_s(coordinate, "(%d,%d)", (int)area._point1.x + area.x, (int)area._point1.y + area.y);
-		cv::putText(roi, coordinate, cv::Point(size.width, size.height + baseLine), 1, 1.5, CV_RGB(0, 255, 255), 2);
+		snprintf(coordinate, sizeof(coordinate), "(%d,%d)", (int)area._point1.x + area.x, (int)area._point1.y + area.y);
+		overlay.putText(coordinate, cv::Point(size.width, size.height + baseLine), 1, 1.5, CV_RGB(0, 255, 255), 2);
 
 		//画中心点+
 		cv::Point2f xLineS(area._point1.x + 10, area._point1.y);
 		cv::Point2f xLineE(area._point1.x - 10, area._point1.y);
-		cv::line(roi, xLineS, xLineE, CV_RGB(255, 0, 0), 2);
+		overlay.line(xLineS, xLineE, CV_RGB(255, 0, 0), 2);
 
 		cv::Point2f yLineS(area._point1.x, area._point1.y + 10);
 		cv::Point2f yLineE(area._point1.x, area._point1.y - 10);
-		cv::line(roi, yLineS, yLineE, CV_RGB(255, 0, 0), 2);
+		overlay.line(yLineS, yLineE, CV_RGB(255, 0, 0), 2);
 
 		//画SFR矩形框
-		cv::rectangle(roi, area._roi, CV_RGB(255, 0, 0), 1);
+		overlay.rectangle(area._roi, CV_RGB(255, 0, 0), 1);
 
 		//画数值
 		cv::Point p(area._roi.x + area._roi.width + 2, area._roi.y + area._roi.height / 2);
@@ -883,41 +2616,38 @@ void sfr::Algorithm::putTextDefault(int index, cv::Mat& source)
 			CV_RGB(0, 255, 0) : CV_RGB(255, 0, 0);
 
 		char value[32] = { 0 };
-		sprintf_s(value, "%.2lf", area._value);
-		cv::putText(roi, cv::String(area._value ? value : "N/A"), p, 1, 1.5, color, 2);
+		snprintf(value, sizeof(value), "%.2lf", area._value);
+		overlay.putText(cv::String(area._value ? value : "N/A"), p, 1, 1.5, color, 2);
 
 		//画耗时时间
 		{
-			m_area[index]._time = cv::getTickCount() / cv::getTickFrequency() * 1000 - m_area[index]._time;
 			int baseLine = 0;
 			char time[32] = { 0 };
-			sprintf_s(time, "%.2lf/ms", m_area[index]._time);
+			snprintf(time, sizeof(time), "%.2lf/ms", latency(area));
 			cv::String text(time);
 			cv::Size&& size = cv::getTextSize(text, 1, 1.5, 2, &baseLine);
-			cv::Point point(roi.cols - size.width, baseLine + size.height);
-			cv::putText(roi, text, point, 1, 1.5, CV_RGB(0, 255, 255), 2);
+			cv::Point point(roi.width - size.width, baseLine + size.height);
+			overlay.putText(text, point, 1, 1.5, CV_RGB(0, 255, 255), 2);
 		}
 	}
 	else
 	{
 		//画中心点+到左下脚
+		overlay.region();
 		cv::Point xLineS(area._rect.x + 10, area._rect.y + area._rect.height);
 		cv::Point xLineE(area._rect.x - 10, area._rect.y + area._rect.height);
-		cv::line(source, xLineS, xLineE, CV_RGB(255, 0, 0), 2);
+		overlay.line(xLineS, xLineE, CV_RGB(255, 0, 0), 2);
 
 		cv::Point yLineS(area._rect.x, area._rect.y + area._rect.height + 10);
 		cv::Point yLineE(area._rect.x, area._rect.y + area._rect.height - 10);
-		cv::line(source, yLineS, yLineE, CV_RGB(255, 0, 0), 2);
+		overlay.line(yLineS, yLineE, CV_RGB(255, 0, 0), 2);
 	}
 
 	//始终等于最后一个
-	if (index == sfr::Area::_size - 1)
+	if (index == m_size - 1)
 	{
-		//定位中心
-		if (m_enable->drawLocateCenter)
-		{
-			locateCenter(source);
-		}
+		//定位中心和视场角
+		drawStaticLayer(source.size(), CV_RGB(255, 250, 205), 1, CV_RGB(255, 250, 205), 1);
 
 		//画结果PASS
 		if (m_enable->drawResultPass)
@@ -934,7 +2664,7 @@ void sfr::Algorithm::putTextDefault(int index, cv::Mat& source)
 			}
 			int baseLine = 0;
 			cv::Size&& size = cv::getTextSize(text, 1, 3, 3, &baseLine);
-			cv::putText(source, text, cv::Point(0, size.height + baseLine), 1, 3, color, 3);
+			m_overlay.putText(text, cv::Point(0, size.height + baseLine), 1, 3, color, 3);
 		}
 
 		//画FPS
@@ -943,27 +2673,24 @@ void sfr::Algorithm::putTextDefault(int index, cv::Mat& source)
 		//	drawFps(source);
 		//}
 
-		//画视场角
-		if (m_enable->drawFovp)
-		{
-			drawFov(source);
-		}
 	}
 }
 
 void sfr::Algorithm::putTextCustom(int index, cv::Mat& source)
 {
 	auto& area = m_area[index];
-	cv::Mat roi = source(area._rect);
+	auto& overlay = area._overlay;
+	overlay.region(area._rect);
+	cv::Size roi = area._rect.size();
 
 	//画区域矩形框
-	cv::rectangle(roi, cv::Rect(0, 0, roi.cols, roi.rows), m_paint->areaRectColor, m_paint->areaRectThickness);
+	overlay.rectangle(cv::Rect(0, 0, roi.width, roi.height), m_paint->areaRectColor, m_paint->areaRectThickness);
 
 	//画编号
 	cv::String&& number = "#" + std::to_string(index);
 	int baseLine = 0;
 	cv::Size&& size = cv::getTextSize(number, 1, m_paint->textScale, m_paint->textThickness, &baseLine);
-	cv::putText(roi, number, cv::Point(0, size.height + baseLine), 1,
+	overlay.putText(number, cv::Point(0, size.height + baseLine), 1,
 		m_paint->textScale, m_paint->textColor, m_paint->textThickness);
 
 	if (area._roiOk) {
@@ -971,21 +2698,21 @@ void sfr::Algorithm::putTextCustom(int index, cv::Mat& source)
 
 		//画坐标
 		char coordinate[32] = { 0 };
-		sprintf_s(coordinate, "(%d,%d)", (int)area._point1.x + area.x, (int)area._point1.y + area.y);
-		cv::putText(roi, coordinate, cv::Point(size.width, size.height + baseLine), 1,
+		snprintf(coordinate, sizeof(coordinate), "(%d,%d)", (int)area._point1.x + area.x, (int)area._point1.y + area.y);
+		overlay.putText(coordinate, cv::Point(size.width, size.height + baseLine), 1,
 			m_paint->textScale, m_paint->textColor, m_paint->textThickness);
 
 		//画中心点+
 		cv::Point2f xLineS(area._point1.x + m_paint->locateLineLength, area._point1.y);
 		cv::Point2f xLineE(area._point1.x - m_paint->locateLineLength, area._point1.y);
-		cv::line(roi, xLineS, xLineE, m_paint->locateLineColor, m_paint->locateLineThickness);
+		overlay.line(xLineS, xLineE, m_paint->locateLineColor, m_paint->locateLineThickness);
 
 		cv::Point2f yLineS(area._point1.x, area._point1.y + m_paint->locateLineLength);
 		cv::Point2f yLineE(area._point1.x, area._point1.y - m_paint->locateLineLength);
-		cv::line(roi, yLineS, yLineE, m_paint->locateLineColor, m_paint->locateLineThickness);
+		overlay.line(yLineS, yLineE, m_paint->locateLineColor, m_paint->locateLineThickness);
 
 		//画ROI矩形框
-		cv::rectangle(roi, area._roi, m_paint->roiRectColor, m_paint->roiRectThickness);
+		overlay.rectangle(area._roi, m_paint->roiRectColor, m_paint->roiRectThickness);
 
 		//画数值
 		cv::Point p(area._roi.x + area._roi.width + 2, area._roi.y + area._roi.height / 2);
@@ -994,38 +2721,37 @@ void sfr::Algorithm::putTextCustom(int index, cv::Mat& source)
 			CV_RGB(0, 255, 0) : CV_RGB(255, 0, 0);
 
 		char value[32] = { 0 };
-		sprintf_s(value, "%.2lf", area._value);
-		cv::putText(roi, cv::String(area._value ? value : "N/A"), p, 1, m_paint->textScale, color, m_paint->textThickness);
+		snprintf(value, sizeof(value), "%.2lf", area._value);
+		overlay.putText(cv::String(area._value ? value : "N/A"), p, 1, m_paint->textScale, color, m_paint->textThickness);
 
 		//画耗时时间
 		{
-			m_area[index]._time = cv::getTickCount() / cv::getTickFrequency() * 1000 - m_area[index]._time;
 			int baseLine = 0;
 			char time[32] = { 0 };
-			sprintf_s(time, "%.0lf/ms", m_area[index]._time);
+			snprintf(time, sizeof(time), "%.0lf/ms", latency(area));
 			cv::String text(time);
 			cv::Size&& size = cv::getTextSize(text, 1, m_paint->textScale, m_paint->textThickness, &baseLine);
-			cv::Point point(roi.cols - size.width, baseLine + size.height);
-			cv::putText(roi, text, point, 1, m_paint->textScale, m_paint->textColor, m_paint->textThickness);
+			cv::Point point(roi.width - size.width, baseLine + size.height);
+			overlay.putText(text, point, 1, m_paint->textScale, m_paint->textColor, m_paint->textThickness);
 		}
 	}
 	else {
 		//画中心点+到左下脚
+		overlay.region();
 		cv::Point xLineS(area._rect.x + m_paint->locateLineLength, area._rect.y + area._rect.height);
 		cv::Point xLineE(area._rect.x - m_paint->locateLineLength, area._rect.y + area._rect.height);
-		cv::line(source, xLineS, xLineE, m_paint->locateLineColor, m_paint->locateLineThickness);
+		overlay.line(xLineS, xLineE, m_paint->locateLineColor, m_paint->locateLineThickness);
 
 		cv::Point yLineS(area._rect.x, area._rect.y + area._rect.height + m_paint->locateLineLength);
 		cv::Point yLineE(area._rect.x, area._rect.y + area._rect.height - m_paint->locateLineLength);
-		cv::line(source, yLineS, yLineE, m_paint->locateLineColor, m_paint->locateLineThickness);
+		overlay.line(yLineS, yLineE, m_paint->locateLineColor, m_paint->locateLineThickness);
 	}
 
 	//始终等于最后一个
-	if (index == sfr::Area::_size - 1) {
-		//定位中心
-		if (m_enable->drawLocateCenter) {
-			locateCenter(source, m_paint->centerLineColor, m_paint->centerLineThickness);
-		}
+	if (index == m_size - 1) {
+		//定位中心和视场角
+		drawStaticLayer(source.size(), m_paint->centerLineColor, m_paint->centerLineThickness,
+			m_paint->fovLineColor, m_paint->fovLineThickness);
 
 		//画结果PASS
 		if (m_enable->drawResultPass) {
@@ -1043,18 +2769,13 @@ void sfr::Algorithm::putTextCustom(int index, cv::Mat& source)
 			double fontScale = m_paint->textScale + 3;
 			int thickness = m_paint->textThickness + 3;
 			cv::Size&& size = cv::getTextSize(text, 1, fontScale, thickness, &baseLine);
-			cv::putText(source, text, cv::Point(0, size.height + baseLine), 1, fontScale, color, thickness);
+			m_overlay.putText(text, cv::Point(0, size.height + baseLine), 1, fontScale, color, thickness);
 		}
 
 		//画FPS
 		//if (m_enable->drawFps) {
 		//	drawFps(source, m_paint->textScale + 2, m_paint->textThickness + 2);
 		//}
-
-		//画视场角
-		if (m_enable->drawFovp) {
-			drawFov(source, m_paint->fovLineColor, m_paint->fovLineThickness);
-		}
 	}
 }
 
@@ -1,22 +1,37 @@
 ﻿#pragma once
 
 #include <map>
+#include <vector>
 #include <mutex>
+#include <atomic>
+#include <memory>
 #include <functional>
 
+#if defined(LIBSFR_OPENCV2)
+#include <opencv2/opencv.hpp>
+#else
 #include <OpenCv/OpenCv.h>
+#endif // LIBSFR_OPENCV2
+
+#ifndef CV_RGB
+#define CV_RGB(r, g, b) cv::Scalar((b), (g), (r), 0)
+#endif // !CV_RGB
 
 #if defined(LIBSFR_NOT_EXPORTS)
 #define SFR_DLL_EXPORT
-#else
+#elif defined(_WIN32)
 #if defined(LIBSFR_EXPORTS)
 #define SFR_DLL_EXPORT __declspec(dllexport)
 #else
 #define SFR_DLL_EXPORT __declspec(dllimport)
 #endif // LIBSFR_EXPORTS
+#if defined(_MSC_VER)
 #pragma warning(push)
 #pragma warning(disable:4251)
 #define SFR_DISABLE_WARNING
+#endif // _MSC_VER
+#else
+#define SFR_DLL_EXPORT __attribute__((visibility("default")))
 #endif // LIBSFR_NOT_EXPORTS
 
 /*
@@ -58,6 +73,42 @@ namespace sfr {
 
 		//视场角百分比
 		double fovp;
+
+		//像元尺寸(um),大于0时输出lp/mm
+		double pixelSize;
+
+		//附加输出的频率列表(cycles/pixel)
+		std::vector<double> frequencies;
+
+		//多帧统计的窗口帧数
+		int window;
+
+		//多帧统计的置信区间半宽小于此值时认为稳定(与SFR值同单位)
+		double tolerance;
+
+		//置信系数,1.96对应95%置信区间,帧数少时换算为同置信度的t分布分位数
+		double confidence;
+
+		//区域变化阈值(抽样点平均灰度差),低于此值复用上次结果,0为不检测
+		double changeThreshold;
+
+		//复用结果的最长时间(ms)
+		double maxAge;
+
+		//复用边缘拟合时抽样行质心允许的偏差(像素)
+		double fitTolerance;
+
+		//定位时按此行数划分水平条带并行预处理,搜索区域不足两个条带时不并行,0为不并行
+		int bandRows;
+
+		//配准验证允许的最大残差(像素),超过时重新配准
+		double registerTolerance;
+
+		//配准后每帧验证的区域数量
+		int probeCount;
+
+		//验证时定位窗口相对于区域尺寸的比例
+		double probeScale;
 	};
 
 	//启用
@@ -76,6 +127,9 @@ namespace sfr {
 
 		//绘制视场角
 		bool drawFovp;
+
+		//ROI稳定时复用上一帧的边缘拟合
+		bool reuseFit;
 	};
 
 	//频率
@@ -129,332 +183,2059 @@ namespace sfr {
 	//最大区域 中心,左上,右上,左下,右下
 	static const int MAX_AREA_SIZE = 5;
 
-	//区域
-	struct SFR_DLL_EXPORT Area {
+	//MTF指标
+	struct SFR_DLL_EXPORT Metrics {
 		//构造
-		Area();
+		Metrics();
 
 		//析构
-		~Area();
+		~Metrics();
 
-		//此区域的x坐标
-		int x;
+		//MTF50对应的频率(cycles/pixel),曲线未下降到50%时为0
+		double mtf50;
 
-		//此区域的y坐标
-		int y;
+		//MTF30对应的频率(cycles/pixel)
+		double mtf30;
 
-		//此区域的宽度
-		int width;
+		//MTF10对应的频率(cycles/pixel)
+		double mtf10;
 
-		//此区域的高度
-		int height;
+		//MTF50对应的频率(lp/mm),未设置像元尺寸时为0
+		double mtf50lp;
 
-		//感兴趣的区域
-		struct {
-			//roi的宽度
-			int width;
+		//MTF30对应的频率(lp/mm)
+		double mtf30lp;
 
-			//roi的高度
-			int height;
+		//MTF10对应的频率(lp/mm)
+		double mtf10lp;
 
-			//x坐标偏移
-			int xOffset;
+		//Data::frequencies对应的插值(0~1),超出曲线范围为NAN
+		std::vector<double> values;
+	};
 
-			//y坐标偏移
-			int yOffset;
-		} roi;//SFR的ROI
+	//边缘拟合
+	struct SFR_DLL_EXPORT Fit {
+		//构造
+		Fit();
 
-		//定位类型
-		int locateType;
+		//析构
+		~Fit();
 
-		//边缘降噪多少个像素点
-		int denoisePixel;
+		//斜率(每行偏移的列数)
+		double slope;
 
-		//此区域的二值化阈值
-		double threshold;
+		//角度(度)
+		double angle;
 
-		//对比度
-		double contrast;
+		//中心行边缘居中所需的偏移
+		double offset;
 
-		//亮度
-		int brightness;
+		//中心行质心位置
+		double centroid;
 
-		double _value = 0;
+		//拟合直线截距
+		double intercept;
 
-		bool _result = false;
+		//拟合优度
+		double r2;
 
-		double _tick = 0;
+		//截距标准误
+		double avar;
 
-		double _time = 0;
+		//斜率标准误
+		double bvar;
 
-		cv::Point2f _point0;
+		//参与计算的行数
+		int rows;
 
-		cv::Point2f _point1;
+		//包含的完整周期数
+		int cycles;
+	};
 
-		cv::Rect _rect;
+	//多帧统计结果
+	struct SFR_DLL_EXPORT Estimate {
+		//构造
+		Estimate();
 
-		cv::Rect _roi;
+		//析构
+		~Estimate();
 
-		bool _roiOk = false;
+		//均值
+		double mean;
 
-		std::map<double, double> _curve;
+		//方差
+		double variance;
 
-		std::mutex _mutex;
+		//中值
+		double median;
 
-		std::function<void(int index, const cv::Mat& mat)> _grab = nullptr;
+		//置信区间半宽
+		double interval;
 
-		static int _size;
+		//帧数
+		int count;
 
+		//是否稳定
+		bool stable;
+	};
+
+	/*
+	* @brief 多帧统计
+	* 保存最近window帧的值,计算均值/方差/中值及置信区间
+	*/
+	class SFR_DLL_EXPORT Estimator {
+	public:
 		/*
-		* @brief 开始抓取此区域
-		* @param[in] index 区域索引
-		* @param[in] mat cv::Mat
-		* @return void
+		* @brief 构造
 		*/
-		void startGrab(const std::function<void(int index, const cv::Mat& mat)>& func);
+		Estimator();
 
 		/*
-		* @brief 停止抓取此区域
+		* @brief 析构
+		*/
+		~Estimator();
+
+		/*
+		* @brief 重置
+		* @param[in] window 窗口帧数
 		* @return void
 		*/
-		void stopGrab();
-	};
+		void reset(int window);
 
-	//位置
-	enum Position {
-		//中心区域
-		CENTER,
+		/*
+		* @brief 清空已有的值
+		* @return void
+		*/
+		void clear();
 
-		//左上区域
-		LEFT_TOP,
+		/*
+		* @brief 添加值
+		* @param[in] value 值
+		* @return void
+		*/
+		void add(double value);
 
-		//右上区域
-		RIGHT_TOP,
+		/*
+		* @brief 帧数
+		* @return int
+		*/
+		int count() const;
 
-		//左下区域
-		LEFT_BOTTOM,
+		/*
+		* @brief 计算统计结果
+		* 置信区间使用n-1自由度的t分布,少于5帧(窗口更小时为窗口帧数)不判断为稳定
+		* @param[in] confidence 置信系数,正态分布的倍数,按相同置信度换算为t分布分位数
+		* @param[in] tolerance 置信区间半宽阈值
+		* @param[out] estimate 统计结果
+		* @return bool 少于2帧返回false
+		*/
+		bool estimate(double confidence, double tolerance, sfr::Estimate& estimate) const;
 
-		//右下区域
-		RIGHT_BOTTOM
+	private:
+		std::vector<double> m_value;
+		mutable std::vector<double> m_sort;
+		int m_window = 0;
+		int m_count = 0;
+		int m_next = 0;
 	};
 
-	//绘图
-	struct SFR_DLL_EXPORT Paint {
-		//构造
-		Paint();
+	//计时阶段
+	enum Stage {
+		//预处理(灰度,增强,二值化,去噪)
+		STAGE_PREPROCESS,
 
-		//析构
-		~Paint();
+		//定位(边缘提取,求交点)
+		STAGE_LOCATE,
 
-		//文本缩放
-		double textScale;
+		//计算ROI
+		STAGE_ROI,
 
-		//文本颜色,不涉及结果颜色
-		cv::Scalar textColor;
+		//ROI灰度转换与归一化
+		STAGE_CONVERT,
 
-		//文本粗细
-		int textThickness;
+		//质心定位与直线拟合
+		STAGE_FIT,
 
-		//区域矩形框颜色
-		cv::Scalar areaRectColor;
+		//ESF投影
+		STAGE_PROJECT,
 
-		//区域矩形框粗细
-		int areaRectThickness;
+		//LSF与DFT
+		STAGE_TRANSFORM,
 
-		//ROI矩形框颜色
-		cv::Scalar roiRectColor;
+		//绘图
+		STAGE_OVERLAY,
 
-		//ROI矩形框粗细
-		int roiRectThickness;
+		STAGE_SIZE,
+	};
 
-		//定位线条颜色
-		cv::Scalar locateLineColor;
+	//多帧累加的状态
+	enum Accumulate {
+		//本帧无效(质量门限,边缘拟合或插值失败),不参与累加,原因参考Algorithm::reason
+		ACCUMULATE_FAILED = -1,
 
-		//定位线条的粗细
-		int locateLineThickness;
+		//已累加,帧数未满
+		ACCUMULATE_PENDING,
 
-		//定位线条的长度
-		int locateLineLength;
+		//累加满帧数,得到了新的结果
+		ACCUMULATE_DONE,
+	};
 
-		//中心线条颜色
-		cv::Scalar centerLineColor;
+	/*
+	* @brief 无锁耗时直方图
+	* 按2的幂分段,每段再分4个桶,百分位的相对误差约12%.
+	* 写入和读取均为原子操作,可在其他线程轮询.
+	*/
+	class SFR_DLL_EXPORT Histogram {
+	public:
+		//构造
+		Histogram();
 
-		//中心线条的粗细
-		int centerLineThickness;
+		//析构
+		~Histogram();
 
-		//视场角线条颜色
-		cv::Scalar fovLineColor;
+		/*
+		* @brief 添加一个样本
+		* @param[in] ns 耗时(ns)
+		* @return void
+		*/
+		void add(long long ns);
 
-		//视场角线条粗细
-		int fovLineThickness;
-	};
+		/*
+		* @brief 百分位
+		* @param[in] p 0~1
+		* @return double 耗时(us),无样本时为0
+		*/
+		double percentile(double p) const;
 
-	class SFR_DLL_EXPORT Algorithm {
-	public:
 		/*
-		* @brief 构造
+		* @brief 均值
+		* @return double 耗时(us)
 		*/
-		Algorithm();
+		double mean() const;
 
 		/*
-		* @brief 构造
-		* @param[in] area 区域
-		* @param[in] data 数据
-		* @param[in] enable 启用
-		* @param[in] paint 绘图
+		* @brief 最近一个样本
+		* @return double 耗时(us)
 		*/
-		Algorithm(sfr::Area* area, sfr::Data* data, sfr::Enable* enable, sfr::Paint* paint = nullptr);
+		double last() const;
 
 		/*
-		* @brief 析构
+		* @brief 样本数量
+		* @return unsigned long long
 		*/
-		~Algorithm();
+		unsigned long long count() const;
 
 		/*
-		* @brief 初始化
-		* @param[in] area 区域
-		* @param[in] data 数据
-		* @param[in] enable 启用
-		* @param[in] paint 绘图
+		* @brief 清空
 		* @return void
 		*/
-		void initialize(sfr::Area* area, sfr::Data* data, sfr::Enable* enable, sfr::Paint* paint = nullptr);
+		void reset();
+
+		static const int BUCKET_SIZE = 256;
+
+	private:
+		Histogram(const Histogram&) = delete;
+		Histogram& operator=(const Histogram&) = delete;
 
+		static int bucket(unsigned long long ns);
+		static double value(int bucket);
+
+		std::atomic<unsigned long long> m_bucket[BUCKET_SIZE];
+		std::atomic<unsigned long long> m_count;
+		std::atomic<unsigned long long> m_sum;
+		std::atomic<unsigned long long> m_last;
+	};
+
+	/*
+	* @brief MTF曲线
+	* 连续存储,第i个值对应的频率为 i / width (cycles/pixel),
+	* width为计算时ROI的宽度.
+	*/
+	class SFR_DLL_EXPORT Curve {
+	public:
 		/*
-		* @brief 是否计算[指定区域]
-		* @param[in] index 区域索引
-		* @return bool
+		* @brief 构造
 		*/
-		bool isCalculate(int index);
+		Curve();
 
 		/*
-		* @brief 获取交叉线中心
-		* @param[in] index 区域索引
-		* @param[in] source 图像源(整个图像)
-		* @return bool
+		* @brief 析构
 		*/
-		bool getCrossLineCenter(int index, const cv::Mat& source);
+		~Curve();
 
 		/*
-		* @brief 计算SFR的ROI
-		* @param[in] index 区域索引
-		* @param[in] thresold 误差阈值(允许与上次获取的坐标相差+-threshold,则返回上次的坐标点)
-		* @return bool
+		* @brief 预留容量,后续写入不超过此容量时不再分配内存
+		* @param[in] capacity 容量
+		* @return void
 		*/
-		bool calculateRoi(int index, float threshold = 2.0f);
+		void reserve(int capacity);
 
 		/*
-		* @brief 计算SFR
-		* @param[in] index 区域索引
-		* @param[in] source 图像源(整个图像)
-		* @return bool
+		* @brief 获取写入地址
+		* @param[in] width ROI的宽度
+		* @param[in] size 曲线长度
+		* @return double* 长度为size的连续内存
 		*/
-		bool calculateSfr(int index, const cv::Mat& source);
+		double* buffer(int width, int size);
 
 		/*
-		* @brief 将数据输出在图像上
-		* @param[in] index 区域索引
-		* @param[in|out] source 图像源(整个图像)
+		* @brief 清空
 		* @return void
 		*/
-		void putText(int index, cv::Mat& source);
+		void clear();
 
 		/*
-		* @brief 区域是否通过
+		* @brief 是否为空
 		* @return bool
 		*/
-		bool isPass() const;
+		bool empty() const;
 
 		/*
-		* @brief SFR的ROI[非线程安全]
-		* @param[in] index 区域索引
-		* @return cv::Rect
+		* @brief 曲线长度
+		* @return int
 		*/
-		cv::Rect roi(int index) const;
+		int size() const;
 
 		/*
-		* @brief SFR的值[线程安全]
-		* @param[in] index 区域索引
-		* @return double
+		* @brief ROI的宽度
+		* @return int
 		*/
-		double value(int index);
+		int width() const;
 
 		/*
-		* @brief SFR的结果[线程安全]
-		* @param[in] index 区域索引
-		* @return bool
+		* @brief 第i个值对应的频率
+		* @param[in] i 索引
+		* @return double
 		*/
-		bool result(int index);
+		double frequency(int i) const;
 
 		/*
-		* @brief MTF曲线[线程安全]
-		* @param[in] index 区域索引
-		* @return MTF曲线MAP
+		* @brief 第i个值
+		* @param[in] i 索引
+		* @return double
 		*/
-		std::map<double, double> curve(int index);
-
-	protected:
+		double operator[](int i) const;
 
 		/*
-		* @brief 定位中心
-		* @param[in|out] img 图像
-		* @param[in] color 虚线颜色
-		* @param[in] thickness 线条粗细
-		* @return void
+		* @brief 连续存储的值
+		* @return const double*
 		*/
-		void locateCenter(cv::Mat& img, const cv::Scalar& color = CV_RGB(255, 250, 205), int thickness = 1) const;
+		const double* data() const;
 
 		/*
-		* @brief 画视场角
-		* @param[in] img 图像
-		* @param[in] color 虚线颜色
-		* @param[in] thickness 线条粗细
-		* @return void
+		* @brief 查找频率恰好落在采样点上的值
+		* @param[in] frequency 频率
+		* @param[out] value 值
+		* @return bool
 		*/
-		void drawFov(cv::Mat& img, const cv::Scalar& color = CV_RGB(255, 250, 205), int thickness = 1);
+		bool find(double frequency, double& value) const;
 
 		/*
-		* @brief 计算SFR
-		* @param[in] area 计算的区域
-		* @param[out] value SFR的值
-		* @param[out] curve MTF曲线
-		* @return bool
+		* @brief 线性插值获取任意频率的值
+		* @param[in] frequency 频率
+		* @param[out] value 值
+		* @return bool 超出曲线范围返回false
 		*/
-		bool calculatesfr(const cv::Mat& area, double& value,
-			std::map<double, double>* curve = nullptr);
+		bool interpolate(double frequency, double& value) const;
 
 		/*
-		* @brief 获取交叉点
-		* @param[in] line1S 线条1起点
-		* @param[in] line1E 线条1终点
-		* @param[in] line2S 线条2起点
-		* @param[in] line2E 线条2终点
-		* @param[in] value 交叉坐标
-		* @return bool
+		* @brief 转换为MAP
+		* @return std::map<double, double>
 		*/
-		bool getCrossPoint(const cv::Point2i& line1S, const cv::Point2i& line1E, const cv::Point2i& line2S, const cv::Point2i& line2E, cv::Point2f& value) const;
+		std::map<double, double> toMap() const;
 
 		/*
-		* @brief 画点线
-		* @param[in|out] img 图像
-		* @param[in] p1 起点
-		* @param[in] p2 终点
-		* @param[in] color 颜色
-		* @param[in] thickness 线条粗细
-		* @return void
+		* @brief 一次遍历计算MTF指标
+		* @param[in] frequencies 需要插值的频率列表(cycles/pixel)
+		* @param[in] count 频率数量
+		* @param[in] pixelSize 像元尺寸(um),为0时不计算lp/mm
+		* @param[out] metrics 指标
+		* @return bool 曲线为空返回false
 		*/
-		void drawPointLine(cv::Mat& img, cv::Point2f p1, cv::Point2f p2, const cv::Scalar& color, int thickness) const;
+		bool metrics(const double* frequencies, int count, double pixelSize, sfr::Metrics& metrics) const;
 
-		/*
+	private:
+		std::vector<double> m_value;
+		int m_size = 0;
+		int m_width = 0;
+	};
+
+	//分通道SFR结果
+	struct SFR_DLL_EXPORT Chroma {
+		//构造
+		Chroma();
+
+		//析构
+		~Chroma();
+
+		//B,G,R通道的MTF曲线
+		sfr::Curve curve[3];
+
+		//B,G,R通道在指定频率的SFR值
+		double value[3];
+
+		//B,G,R通道边缘相对G通道的偏移(像素,沿行方向)
+		double offset[3];
+
+		//共用的边缘拟合
+		sfr::Fit fit;
+	};
+
+	//绘图模式
+	enum OverlayMode {
+		//直接绘制在图像源上
+		OVERLAY_DIRECT,
+
+		//不绘制
+		OVERLAY_HEADLESS,
+
+		//记录绘图命令,调用preview时绘制在(可缩放的)副本上
+		OVERLAY_DEFERRED,
+	};
+
+	/*
+	* @brief 绘图层
+	* 绑定图像时直接绘制,未绑定时记录绘图命令,之后通过render回放.
+	* 命令坐标相对于当前区域,并裁剪在区域内.
+	*/
+	class SFR_DLL_EXPORT Overlay {
+	public:
+		/*
+		* @brief 构造
+		*/
+		Overlay();
+
+		/*
+		* @brief 析构
+		*/
+		~Overlay();
+
+		/*
+		* @brief 绑定图像
+		* @param[in] target 直接绘制的图像,为nullptr时记录命令
+		* @return void
+		*/
+		void bind(cv::Mat* target);
+
+		/*
+		* @brief 清空记录的命令
+		* @return void
+		*/
+		void clear();
+
+		/*
+		* @brief 是否没有记录的命令
+		* @return bool
+		*/
+		bool empty() const;
+
+		/*
+		* @brief 设置当前区域
+		* @param[in] rect 区域,为空时表示整个图像
+		* @return void
+		*/
+		void region(const cv::Rect& rect = cv::Rect());
+
+		/*
+		* @brief 画线
+		* @return void
+		*/
+		void line(const cv::Point2f& p1, const cv::Point2f& p2, const cv::Scalar& color, int thickness);
+
+		/*
+		* @brief 画矩形
+		* @return void
+		*/
+		void rectangle(const cv::Rect& rect, const cv::Scalar& color, int thickness);
+
+		/*
+		* @brief 画圆
+		* @return void
+		*/
+		void circle(const cv::Point2f& center, int radius, const cv::Scalar& color, int thickness);
+
+		/*
+		* @brief 画椭圆弧
+		* @return void
+		*/
+		void ellipse(const cv::Point& center, const cv::Size& axes, double angle,
+			double start, double end, const cv::Scalar& color, int thickness);
+
+		/*
+		* @brief 画文本
+		* @return void
+		*/
+		void putText(const cv::String& text, const cv::Point& org, int fontFace, double scale, const cv::Scalar& color, int thickness);
+
+		/*
+		* @brief 按掩码填充颜色
+		* @param[in] mask 与整个图像同尺寸的掩码,记录时不复制数据
+		* @param[in] color 颜色
+		* @return void
+		*/
+		void mask(const cv::Mat& mask, const cv::Scalar& color);
+
+		/*
+		* @brief 回放记录的命令
+		* @param[in|out] img 图像
+		* @param[in] scale img相对于原图的缩放比例
+		* @return void
+		*/
+		void render(cv::Mat& img, double scale = 1.0) const;
+
+	private:
+		enum Type {
+			LINE,
+			RECTANGLE,
+			CIRCLE,
+			ELLIPSE,
+			TEXT,
+			MASK,
+		};
+
+		struct Command {
+			int type = LINE;
+			cv::Rect region;
+			cv::Point2f p1;
+			cv::Point2f p2;
+			cv::Size size;
+			double angle = 0;
+			double start = 0;
+			double end = 0;
+			double scale = 1;
+			int font = 1;
+			cv::Scalar color;
+			int thickness = 1;
+			cv::String text;
+			cv::Mat mat;
+		};
+
+		Command& next(int type);
+
+		void commit(const Command& command);
+
+		static void draw(cv::Mat& img, const Command& command, double scale);
+
+		cv::Mat* m_target = nullptr;
+		cv::Mat m_view;
+		cv::Rect m_region;
+		Command m_direct;
+		std::vector<Command> m_command;
+		int m_size = 0;
+	};
+
+	/*
+	* @brief 抓取环形缓冲区
+	* 预分配固定数量的缓冲区,测量线程发布图像时从不等待读取线程,
+	* 若所有空闲缓冲区都被读取端持有,则丢弃此帧.
+	*/
+	class SFR_DLL_EXPORT Tap {
+		struct Slot {
+			cv::Mat mat;
+			int index = -1;
+			unsigned long long sequence = 0;
+			double tick = 0;
+			std::atomic<int> readers{ 0 };
+		};
+
+	public:
+		//帧,持有期间对应的缓冲区不会被覆盖
+		class SFR_DLL_EXPORT Frame {
+		public:
+			Frame() = default;
+
+			Frame(Frame&& other) noexcept;
+
+			Frame& operator=(Frame&& other) noexcept;
+
+			Frame(const Frame&) = delete;
+
+			Frame& operator=(const Frame&) = delete;
+
+			~Frame();
+
+			/*
+			* @brief 是否为空
+			* @return bool
+			*/
+			bool empty() const;
+
+			/*
+			* @brief 图像,若需在释放后继续使用请clone
+			* @return const cv::Mat&
+			*/
+			const cv::Mat& mat() const;
+
+			/*
+			* @brief 区域索引
+			* @return int
+			*/
+			int index() const;
+
+			/*
+			* @brief 发布序号
+			* @return unsigned long long
+			*/
+			unsigned long long sequence() const;
+
+			/*
+			* @brief 发布时间(ms)
+			* @return double
+			*/
+			double tick() const;
+
+			/*
+			* @brief 释放缓冲区
+			* @return void
+			*/
+			void release();
+
+		private:
+			friend class Tap;
+
+			explicit Frame(Slot* slot);
+
+			Slot* m_slot = nullptr;
+		};
+
+		/*
+		* @brief 构造
+		* @param[in] capacity 缓冲区数量(最少2个)
+		* @param[in] size 预分配图像尺寸
+		* @param[in] type 预分配图像类型
+		*/
+		Tap(int capacity, const cv::Size& size, int type);
+
+		/*
+		* @brief 析构
+		*/
+		~Tap();
+
+		/*
+		* @brief 发布图像[仅测量线程调用,不阻塞]
+		* @param[in] index 区域索引
+		* @param[in] mat 图像
+		* @return bool 缓冲区全部被占用时返回false
+		*/
+		bool publish(int index, const cv::Mat& mat);
+
+		/*
+		* @brief 获取最新的帧[线程安全,不阻塞]
+		* @return Frame 尚未发布时为空
+		*/
+		Frame acquire() const;
+
+		/*
+		* @brief 已发布的帧数
+		* @return unsigned long long
+		*/
+		unsigned long long sequence() const;
+
+		/*
+		* @brief 丢弃的帧数
+		* @return unsigned long long
+		*/
+		unsigned long long dropped() const;
+
+	private:
+		std::unique_ptr<Slot[]> m_slot;
+		int m_capacity = 0;
+		std::atomic<int> m_latest{ -1 };
+		std::atomic<unsigned long long> m_sequence{ 0 };
+		std::atomic<unsigned long long> m_dropped{ 0 };
+	};
+
+	//图像质量
+	enum Quality {
+		//合格
+		QUALITY_OK,
+
+		//太暗
+		QUALITY_TOO_DARK,
+
+		//过曝
+		QUALITY_SATURATED,
+
+		//对比度不足
+		QUALITY_LOW_CONTRAST,
+
+		//ROI内未找到边缘
+		QUALITY_EDGE_NOT_FOUND,
+
+		//边缘太靠近ROI边界
+		QUALITY_EDGE_NEAR_BORDER,
+
+		//边缘模糊(运动模糊或严重离焦)
+		QUALITY_BLURRED,
+	};
+
+	//失败原因,质量门限的原因与Quality取值相同
+	enum Reason {
+		//成功
+		REASON_OK = QUALITY_OK,
+
+		//质量门限:太暗
+		REASON_TOO_DARK = QUALITY_TOO_DARK,
+
+		//质量门限:过曝
+		REASON_SATURATED = QUALITY_SATURATED,
+
+		//质量门限:对比度不足
+		REASON_LOW_CONTRAST = QUALITY_LOW_CONTRAST,
+
+		//质量门限:ROI内未找到边缘
+		REASON_EDGE_NOT_FOUND = QUALITY_EDGE_NOT_FOUND,
+
+		//质量门限:边缘太靠近ROI边界
+		REASON_EDGE_NEAR_BORDER = QUALITY_EDGE_NEAR_BORDER,
+
+		//质量门限:边缘模糊
+		REASON_BLURRED = QUALITY_BLURRED,
+
+		//定位:定位类型不支持
+		REASON_LOCATE_TYPE,
+
+		//定位:二值化后全黑或全白,亮度/对比度/阈值不合适
+		REASON_LOCATE_BRIGHTNESS,
+
+		//定位:边缘点集为空或不足以找到交叉线
+		REASON_LOCATE_NO_EDGE,
+
+		//定位:交叉线平行,getCrossPoint无交点
+		REASON_LOCATE_NO_CROSS,
+
+		//ROI超出区域
+		REASON_ROI_OUT_OF_RANGE,
+
+		//自动ROI:区域内未找到满足check_slope的斜边
+		REASON_ROI_NO_EDGE,
+
+		//SFR:ROI宽度为奇数(sfr_proc返回1)
+		REASON_SFR_ODD_WIDTH,
+
+		//SFR:边缘太靠近ROI角落(sfr_proc返回2)
+		REASON_SFR_EDGE_NEAR_CORNER,
+
+		//SFR:斜率不合格(sfr_proc返回3)
+		REASON_SFR_BAD_SLOPE,
+
+		//SFR:指定频率超出MTF曲线范围
+		REASON_SFR_FREQUENCY,
+
+		REASON_SIZE,
+	};
+
+	/*
+	* @brief 质量门限
+	* 在定位和计算SFR之前,对原始图像抽样检查,不合格的帧提前放弃
+	*/
+	struct SFR_DLL_EXPORT Gate {
+		//构造
+		Gate();
+
+		//析构
+		~Gate();
+
+		//抽样间隔(像素)
+		int step;
+
+		//最大灰度低于此值为太暗
+		double darkLevel;
+
+		//灰度不低于此值视为饱和
+		double saturationLevel;
+
+		//饱和像素比例超过此值为过曝
+		double saturationRatio;
+
+		//最大与最小灰度之差低于此值为对比度不足
+		double minContrast;
+
+		//ROI内抽样检查边缘的行数
+		int edgeRows;
+
+		//边缘与ROI左右边界的最小距离(像素)
+		int edgeMargin;
+
+		//边缘10%~90%上升宽度超过此值为模糊(像素)
+		double maxEdgeWidth;
+	};
+
+	//区域
+	struct SFR_DLL_EXPORT Area {
+		//构造
+		Area();
+
+		//析构
+		~Area();
+
+		//此区域的x坐标
+		int x;
+
+		//此区域的y坐标
+		int y;
+
+		//此区域的宽度
+		int width;
+
+		//此区域的高度
+		int height;
+
+		//感兴趣的区域
+		struct {
+			//roi的宽度
+			int width;
+
+			//roi的高度
+			int height;
+
+			//x坐标偏移
+			int xOffset;
+
+			//y坐标偏移
+			int yOffset;
+		} roi;//SFR的ROI
+
+		//定位类型
+		int locateType;
+
+		//边缘降噪多少个像素点
+		int denoisePixel;
+
+		//此区域的二值化阈值
+		double threshold;
+
+		//对比度
+		double contrast;
+
+		//亮度
+		int brightness;
+
+		double _value = 0;
+
+		bool _result = false;
+
+		double _tick = 0;
+
+		cv::Point2f _point0;
+
+		cv::Point2f _point1;
+
+		cv::Rect _rect;
+
+		cv::Rect _roi;
+
+		//detectRoi找到的ROI,相对于_rect
+		std::vector<cv::Rect> _rois;
+
+		bool _roiOk = false;
+
+		sfr::Curve _curve;
+
+		sfr::Metrics _metrics;
+
+		sfr::Fit _fit;
+
+		//复用的边缘拟合,rows为0时无效
+		sfr::Fit _cacheFit;
+
+		sfr::Estimator _estimator;
+
+		sfr::Histogram _timing[STAGE_SIZE];
+
+		//上次putText时各阶段的样本数,样本数未变的阶段本帧没有执行
+		unsigned long long _drawn[STAGE_SIZE] = {};
+
+		int _quality = QUALITY_OK;
+
+		//最近一次的失败原因与各原因的累计次数,无锁读取
+		std::atomic<int> _reason{ REASON_OK };
+
+		std::atomic<unsigned long long> _reasons[REASON_SIZE] = {};
+
+		//上次测量成功时的区域指纹及时间
+		std::vector<uchar> _fingerprint;
+
+		double _measured = 0;
+
+		//isCalculate取得的指纹,测量成功后才替换_fingerprint
+		std::vector<uchar> _pending;
+
+		double _pendingTick = -1;
+
+		//多帧累加的ESF(四倍超采样)
+		struct {
+			std::vector<double> sums;
+			std::vector<int> counts;
+			int width = 0;
+			int frames = 0;
+		} _esf;
+
+		//条带并行预处理的工作区,含上下halo行
+		struct Tile {
+			cv::Mat src;
+			cv::Mat thr;
+			cv::Mat edge;
+			std::vector<cv::Point> points;
+		};
+
+		//定位的工作区,initialize时按区域尺寸预留,Mat与容器稳定后复用,OpenCV滤波内部仍可能分配
+		struct {
+			cv::Mat gray;
+			cv::Mat thr;
+			cv::Mat edge;
+			std::vector<cv::Point> pixels;
+			std::vector<cv::Point> coord;
+			std::vector<cv::Point> vec;
+			std::vector<int> values;
+			std::vector<Tile> tiles;
+		} _work;
+
+		sfr::Overlay _overlay;
+
+		std::mutex _mutex;
+
+		std::function<void(int index, const cv::Mat& mat)> _grab = nullptr;
+
+		std::shared_ptr<sfr::Tap> _maskTap;
+
+		std::shared_ptr<sfr::Tap> _roiTap;
+
+		static int _size;
+
+		/*
+		* @brief 开始抓取此区域
+		* @param[in] index 区域索引
+		* @param[in] mat cv::Mat,引用区域工作区,回调返回后会被覆盖,需保留请clone
+		* @return void
+		*/
+		void startGrab(const std::function<void(int index, const cv::Mat& mat)>& func);
+
+		/*
+		* @brief 停止抓取此区域
+		* @return void
+		*/
+		void stopGrab();
+
+		/*
+		* @brief 开始异步抓取此区域
+		* 二值化图像(及可选的ROI图像)发布到预分配的环形缓冲区,
+		* 由读取线程通过maskTap/roiTap获取,测量线程不会等待读取线程.
+		* @param[in] capacity 缓冲区数量
+		* @param[in] roi 是否同时发布ROI图像
+		* @return void
+		*/
+		void startTap(int capacity = 3, bool roi = false);
+
+		/*
+		* @brief 停止异步抓取此区域
+		* @return void
+		*/
+		void stopTap();
+
+		/*
+		* @brief 二值化图像缓冲区[线程安全]
+		* @return std::shared_ptr<sfr::Tap> 未开始时为nullptr
+		*/
+		std::shared_ptr<sfr::Tap> maskTap() const;
+
+		/*
+		* @brief ROI图像缓冲区[线程安全]
+		* @return std::shared_ptr<sfr::Tap> 未开始时为nullptr
+		*/
+		std::shared_ptr<sfr::Tap> roiTap() const;
+	};
+
+	//内存分配统计的阶段
+	enum AllocStage {
+		//其他
+		ALLOC_OTHER,
+
+		//定位(getCrossLineCenter)
+		ALLOC_LOCATE,
+
+		//计算SFR(calculateSfr/accumulateSfr/calculateChroma)
+		ALLOC_SFR,
+
+		//绘图(putText/preview)
+		ALLOC_OVERLAY,
+
+		ALLOC_STAGE_SIZE,
+	};
+
+	//内存分配统计
+	struct SFR_DLL_EXPORT AllocStats {
+		//构造
+		AllocStats();
+
+		//析构
+		~AllocStats();
+
+		//各阶段的分配次数
+		unsigned long long count[ALLOC_STAGE_SIZE];
+
+		//各阶段的分配字节数
+		unsigned long long bytes[ALLOC_STAGE_SIZE];
+
+		//帧数
+		unsigned long long frames;
+	};
+
+	/*
+	* @brief 内存分配统计的阶段作用域
+	* 定义LIBSFR_ALLOC_STATS编译时,统计operator new,cv::Mat及mitre_sfr临时缓冲区
+	* 的分配,并记入当前线程所在的阶段;未定义时为空操作.
+	*/
+	class SFR_DLL_EXPORT AllocScope {
+	public:
+		/*
+		* @brief 构造,进入阶段
+		* @param[in] stage 参考AllocStage
+		*/
+		explicit AllocScope(int stage);
+
+		//析构,恢复上一个阶段
+		~AllocScope();
+
+		/*
+		* @brief 是否编译了统计
+		* @return bool
+		*/
+		static bool enabled();
+
+		/*
+		* @brief 标记一帧结束
+		* @return void
+		*/
+		static void frame();
+
+		/*
+		* @brief 读取统计
+		* @param[out] stats 统计
+		* @return void
+		*/
+		static void snapshot(sfr::AllocStats& stats);
+
+		/*
+		* @brief 清空统计
+		* @return void
+		*/
+		static void reset();
+
+		/*
+		* @brief 安装mitre_sfr的线程内存池,临时缓冲区预热后不再分配
+		* 进程内只安装一次,内存池按线程独立,池外的请求回退到malloc,
+		* 与其他直接调用mitre_sfr的线程兼容.调用方自行sfr_set_allocator时需在此之后且在计算开始之前
+		* @return void
+		*/
+		static void installScratch();
+
+	private:
+		AllocScope(const AllocScope&) = delete;
+		AllocScope& operator=(const AllocScope&) = delete;
+		int m_stage;
+	};
+
+	/*
+	* @brief 流水线追踪的作用域
+	* 定义LIBSFR_TRACE编译时,作用域的起止时间写入当前线程的环形缓冲区,
+	* 可导出为Chrome trace JSON,使用Perfetto或chrome://tracing查看;
+	* 未定义时SFR_TRACE_SCOPE展开为空,没有任何开销.
+	*/
+	class SFR_DLL_EXPORT Trace {
+	public:
+		/*
+		* @brief 构造,开始一个事件
+		* @param[in] name 事件名,必须为静态字符串
+		*/
+		explicit Trace(const char* name);
+
+		//析构,结束事件
+		~Trace();
+
+		/*
+		* @brief 是否编译了追踪
+		* @return bool
+		*/
+		static bool enabled();
+
+		/*
+		* @brief 导出所有线程缓冲区中的事件
+		* @param[in] path Chrome trace JSON文件路径
+		* @return bool
+		*/
+		static bool dump(const std::string& path);
+
+		/*
+		* @brief 设置延时阈值,线程最外层事件超过阈值时自动导出
+		* 导出在后台线程执行,不阻塞超时的线程;每次导出按序号命名,如slow.json导出为slow-1.json,slow-2.json...,
+		* 上一次导出未完成时的超时不再导出
+		* @param[in] ms 阈值(ms),小于等于0关闭
+		* @param[in] path 导出路径,序号插入在扩展名之前
+		* @return void
+		*/
+		static void setThreshold(double ms, const std::string& path);
+
+		/*
+		* @brief 清空所有线程缓冲区
+		* 只能在没有任何线程处于SFR_TRACE_SCOPE内时调用,与记录并发时缓冲区的计数可能错乱
+		* @return void
+		*/
+		static void clear();
+
+	private:
+		Trace(const Trace&) = delete;
+		Trace& operator=(const Trace&) = delete;
+		const char* m_name;
+		long long m_begin;
+	};
+
+#ifdef LIBSFR_TRACE
+#define SFR_TRACE_CONCAT_(a, b) a##b
+#define SFR_TRACE_CONCAT(a, b) SFR_TRACE_CONCAT_(a, b)
+#define SFR_TRACE_SCOPE(name) sfr::Trace SFR_TRACE_CONCAT(sfrTrace, __LINE__)(name)
+#else
+#define SFR_TRACE_SCOPE(name) ((void)0)
+#endif
+
+	//位置
+	enum Position {
+		//中心区域
+		CENTER,
+
+		//左上区域
+		LEFT_TOP,
+
+		//右上区域
+		RIGHT_TOP,
+
+		//左下区域
+		LEFT_BOTTOM,
+
+		//右下区域
+		RIGHT_BOTTOM
+	};
+
+	//绘图
+	struct SFR_DLL_EXPORT Paint {
+		//构造
+		Paint();
+
+		//析构
+		~Paint();
+
+		//文本缩放
+		double textScale;
+
+		//文本颜色,不涉及结果颜色
+		cv::Scalar textColor;
+
+		//文本粗细
+		int textThickness;
+
+		//区域矩形框颜色
+		cv::Scalar areaRectColor;
+
+		//区域矩形框粗细
+		int areaRectThickness;
+
+		//ROI矩形框颜色
+		cv::Scalar roiRectColor;
+
+		//ROI矩形框粗细
+		int roiRectThickness;
+
+		//定位线条颜色
+		cv::Scalar locateLineColor;
+
+		//定位线条的粗细
+		int locateLineThickness;
+
+		//定位线条的长度
+		int locateLineLength;
+
+		//中心线条颜色
+		cv::Scalar centerLineColor;
+
+		//中心线条的粗细
+		int centerLineThickness;
+
+		//视场角线条颜色
+		cv::Scalar fovLineColor;
+
+		//视场角线条粗细
+		int fovLineThickness;
+	};
+
+	/*
+	* @brief 过焦扫描
+	* 逐个输入(运动位置,各区域SFR)样本,对各区域拟合离焦曲线.
+	* 先按固定步长爬山,峰值被夹住后使用黄金分割搜索,区间小于容差时结束.
+	*/
+	class SFR_DLL_EXPORT ThroughFocus {
+	public:
+		/*
+		* @brief 构造
+		*/
+		ThroughFocus();
+
+		/*
+		* @brief 析构
+		*/
+		~ThroughFocus();
+
+		/*
+		* @brief 开始扫描,清空已有样本
+		* @param[in] begin 起始位置
+		* @param[in] end 结束位置
+		* @param[in] step 爬山步长
+		* @param[in] tolerance 峰值区间小于此宽度时结束
+		* @param[in] target 搜索依据的区域(Position),为-1时使用所有区域之和
+		* @param[in] drop 低于当前最大值的比例超过drop才认为越过峰值,用于抑制噪声
+		* @return void
+		*/
+		void start(long begin, long end, long step, long tolerance, int target = CENTER, double drop = 0.0);
+
+		/*
+		* @brief 添加样本
+		* @param[in] frequency 运动位置及各区域的SFR
+		* @return void
+		*/
+		void add(const sfr::Frequency& frequency);
+
+		/*
+		* @brief 添加样本
+		* @param[in] position 运动位置
+		* @param[in] value 各区域的SFR,按Position排列
+		* @param[in] count 区域数量
+		* @return void
+		*/
+		void add(long position, const double* value, int count);
+
+		/*
+		* @brief 建议的下一个运动位置
+		* @param[out] position 运动位置
+		* @return bool 扫描结束返回false
+		*/
+		bool next(long& position) const;
+
+		/*
+		* @brief 扫描是否结束
+		* @return bool
+		*/
+		bool finished() const;
+
+		/*
+		* @brief 样本数量
+		* @return int
+		*/
+		int samples() const;
+
+		/*
+		* @brief 区域数量
+		* @return int
+		*/
+		int areas() const;
+
+		/*
+		* @brief 区域的峰值,在最大值附近二次拟合得到亚步长的位置
+		* @param[in] area 区域索引
+		* @param[out] position 峰值位置
+		* @param[out] value 峰值
+		* @return bool 样本不足返回false
+		*/
+		bool peak(int area, double& position, double& value) const;
+
+	private:
+		enum State {
+			CLIMB,
+			GOLDEN,
+			DONE,
+		};
+
+		struct Sample {
+			long position;
+			double value[MAX_AREA_SIZE];
+		};
+
+		double objective(const Sample& sample) const;
+
+		double objective(long position) const;
+
+		std::vector<Sample> m_sample;
+		int m_areas = 0;
+		int m_state = DONE;
+		int m_target = CENTER;
+		long m_begin = 0;
+		long m_end = 0;
+		long m_step = 1;
+		long m_tolerance = 1;
+		long m_last = 0;
+		double m_drop = 0;
+		double m_best = 0;
+		long m_bestPosition = 0;
+		long m_bracket[3] = { 0 };
+	};
+
+	//像面倾斜
+	struct SFR_DLL_EXPORT Tilt {
+		//构造
+		Tilt();
+
+		//析构
+		~Tilt();
+
+		//沿X方向的倾斜角(度)
+		double x;
+
+		//沿Y方向的倾斜角(度)
+		double y;
+
+		//图像中心的最佳焦点(运动位置)
+		double focus;
+
+		//场曲,视场边缘相对于中心的离焦量(运动位置)
+		double curvature;
+
+		//等效偏心,场曲顶点相对于图像中心的偏移(像素)
+		cv::Point2f decenter;
+
+		//拟合残差RMS(运动位置)
+		double residual;
+
+		//参与拟合的区域数量
+		int count;
+	};
+
+	/*
+	* @brief 像面倾斜和场曲求解
+	* 以各区域的最佳焦点拟合 z = z0 + a * x + b * y + c * (x^2 + y^2),
+	* 少于4个区域时不拟合场曲.每次过焦扫描样本更新后均可重新求解.
+	*/
+	class SFR_DLL_EXPORT TiltSolver {
+	public:
+		/*
+		* @brief 构造
+		*/
+		TiltSolver();
+
+		/*
+		* @brief 析构
+		*/
+		~TiltSolver();
+
+		/*
+		* @brief 初始化
+		* @param[in] area 区域,使用定位后的中心,未定位时使用区域中心
+		* @param[in] count 区域数量
+		* @param[in] size 图像尺寸
+		* @param[in] pixelSize 像元尺寸(um)
+		* @param[in] stepSize 每个运动位置对应的距离(um)
+		* @return void
+		*/
+		void initialize(const sfr::Area* area, int count, const cv::Size& size,
+			double pixelSize, double stepSize);
+
+		/*
+		* @brief 使用过焦扫描当前的峰值更新
+		* @param[in] focus 过焦扫描
+		* @return bool
+		*/
+		bool update(const sfr::ThroughFocus& focus);
+
+		/*
+		* @brief 使用各区域的最佳焦点更新
+		* @param[in] peak 各区域的最佳焦点(运动位置)
+		* @param[in] valid 各区域是否有效,为nullptr时全部有效
+		* @param[in] count 区域数量
+		* @return bool 有效区域少于3个返回false
+		*/
+		bool update(const double* peak, const bool* valid, int count);
+
+		/*
+		* @brief 结果
+		* @param[out] tilt 像面倾斜
+		* @return bool 尚未成功求解返回false
+		*/
+		bool result(sfr::Tilt& tilt) const;
+
+	private:
+		cv::Point2d m_point[MAX_AREA_SIZE];
+		int m_count = 0;
+		double m_pixelSize = 1;
+		double m_stepSize = 1;
+		bool m_ok = false;
+		sfr::Tilt m_tilt;
+	};
+
+	//点扩散函数
+	enum Blur {
+		//高斯
+		BLUR_GAUSSIAN,
+
+		//离焦(均匀圆盘)
+		BLUR_DEFOCUS,
+	};
+
+	//合成图像参数
+	struct SFR_DLL_EXPORT Synth {
+		//构造
+		Synth();
+
+		//析构
+		~Synth();
+
+		//刃边或图标相对竖直方向的旋转角度(度)
+		double angle;
+
+		//点扩散函数,参考Blur
+		int blur;
+
+		//高斯点扩散函数的标准差(像素)
+		double sigma;
+
+		//离焦圆盘半径(像素)
+		double radius;
+
+		//暗电平(线性,0~1)
+		double black;
+
+		//亮电平(线性,0~1)
+		double white;
+
+		//高斯噪声标准差(线性,0~1),在gamma编码之前加入
+		double noise;
+
+		//gamma,输出为线性值的1/gamma次方,1为线性
+		double gamma;
+
+		//位深(1~16),量化为2^bits级后映射到满量程,不大于8时输出CV_8UC3,否则输出CV_16UC3;
+		//Algorithm只接受8位图像,16位图像需先缩放转换,FieldMap可直接使用
+		int bits;
+
+		//像元积分的超采样倍数
+		int oversample;
+
+		//噪声随机数种子
+		unsigned int seed;
+	};
+
+	/*
+	* @brief 合成图像生成器
+	* 生成真实MTF已知的倾斜刃边和图卡,用于校验计算精度及提供基准输入.
+	* 真实MTF为点扩散函数的MTF与像元孔径sinc的乘积.
+	*/
+	class SFR_DLL_EXPORT Generator {
+	public:
+		/*
+		* @brief 构造
+		* @param[in] synth 合成参数
+		*/
+		explicit Generator(const sfr::Synth& synth = sfr::Synth());
+
+		//析构
+		~Generator();
+
+		/*
+		* @brief 倾斜刃边,左暗右亮,边缘过图像中心
+		* @param[in] size 图像尺寸
+		* @return cv::Mat BGR图像
+		*/
+		cv::Mat edge(const cv::Size& size) const;
+
+		/*
+		* @brief 图卡,中心及四角各一个图标,图标形状与颜色由locateType决定
+		* @param[in] size 图像尺寸
+		* @param[in] locateType 参考LocateType,不支持SEARCH_AREA_CENTER_FIXED_POSTION
+		* @param[in] radius 图标半径(像素)
+		* @param[in] fovp 四角图标所在的视场百分比
+		* @param[out] centers 中心,左上,右上,左下,右下图标的中心,可为nullptr
+		* @return cv::Mat BGR图像,参数无效时为空
+		*/
+		cv::Mat chart(const cv::Size& size, int locateType, int radius, double fovp = 70,
+			std::vector<cv::Point2f>* centers = nullptr) const;
+
+		/*
+		* @brief 解析MTF
+		* @param[in] frequency 频率(cycles/pixel)
+		* @param[in] aperture 是否包含像元孔径
+		* @return double
+		*/
+		double mtf(double frequency, bool aperture = true) const;
+
+	private:
+		//线性图像[0,1]加噪声,gamma编码并量化
+		cv::Mat encode(const cv::Mat& linear) const;
+
+		sfr::Synth m_synth;
+	};
+
+	//全视场SFR分布的边缘方向
+	enum FieldDirection {
+		//近似竖直的边缘(水平方向的SFR)
+		FIELD_VERTICAL,
+
+		//近似水平的边缘(竖直方向的SFR)
+		FIELD_HORIZONTAL,
+
+		//两个方向的平均
+		FIELD_BOTH,
+
+		FIELD_DIRECTION_SIZE,
+	};
+
+	//全视场SFR分布参数
+	struct SFR_DLL_EXPORT Field {
+		//构造
+		Field();
+
+		//析构
+		~Field();
+
+		//网格单元边长(像素),每个单元独立检测斜边
+		int cellSize;
+
+		//ROI最大宽度(像素)
+		int roiWidth;
+
+		//ROI最大高度(像素)
+		int roiHeight;
+
+		//计算SFR值的频率(cycles/pixel)
+		double frequency;
+
+		//是否检测近似水平的边缘(转置后计算)
+		bool horizontal;
+
+		//是否用反距离加权插值填补没有边缘的单元
+		bool interpolate;
+	};
+
+	/*
+	* @brief 全视场SFR分布
+	* 用于密集斜边图卡(如倾斜棋盘格).整幅图像按网格划分,各单元并行检测斜边,
+	* 所有边缘再并行批量计算SFR,每个单元取其中边缘SFR的平均值.
+	*/
+	class SFR_DLL_EXPORT FieldMap {
+	public:
+		/*
+		* @brief 构造
+		* @param[in] field 参数
+		*/
+		explicit FieldMap(const sfr::Field& field = sfr::Field());
+
+		//析构
+		~FieldMap();
+
+		/*
+		* @brief 计算全视场SFR分布
+		* @param[in] source 源图像(BGR,BGRA或灰度),8位,16位或[0,1]的浮点,按位深缩放到8位
+		* @return int 计算成功的边缘数量,其他通道数返回0并清空结果
+		*/
+		int calculate(const cv::Mat& source);
+
+		/*
+		* @brief SFR分布
+		* @param[in] direction 参考FieldDirection
+		* @return const cv::Mat& CV_64FC1,每个元素为一个单元的SFR值(与Algorithm相同乘以100),
+		* 没有边缘且未插值的单元为NaN
+		*/
+		const cv::Mat& map(int direction = FIELD_BOTH) const;
+
+		/*
+		* @brief 计算成功的边缘
+		* @param[in] direction 参考FieldDirection
+		* @return const std::vector<cv::Rect>& ROI(整个图像的坐标)
+		*/
+		const std::vector<cv::Rect>& edges(int direction = FIELD_VERTICAL) const;
+
+		/*
+		* @brief 将SFR分布以伪彩色叠加在图像上
+		* @param[in|out] display 图像(BGR),尺寸与计算时的源图像相同
+		* @param[in] direction 参考FieldDirection
+		* @param[in] alpha 伪彩色的不透明度
+		* @return void
+		*/
+		void draw(cv::Mat& display, int direction = FIELD_BOTH, double alpha = 0.5) const;
+
+	private:
+		//边缘的计算任务
+		struct Job {
+			cv::Rect roi;
+			int cell;
+			int direction;
+			double value;
+			bool result;
+		};
+
+		/*
+		* @brief 使用Algorithm::calculateEdge计算单个ROI,缓冲区按线程复用
+		* @param[in] roi 灰度ROI(CV_8UC1)
+		* @param[in] frequency 取值的频率(cycles/pixel)
+		* @param[out] value SFR值
+		* @return bool
+		*/
+		static bool measureEdge(const cv::Mat& roi, double frequency, double& value);
+
+		sfr::Field m_field;
+		int m_cell = 0;
+		cv::Mat m_gray;
+		cv::Mat m_map[FIELD_DIRECTION_SIZE];
+		std::vector<cv::Rect> m_edges[FIELD_BOTH];
+		std::vector<std::vector<Job>> m_cells;
+		std::vector<Job> m_jobs;
+	};
+
+	class SFR_DLL_EXPORT Algorithm {
+	public:
+		/*
+		* @brief 构造
+		*/
+		Algorithm();
+
+		/*
+		* @brief 构造
+		* @param[in] area 区域
+		* @param[in] data 数据
+		* @param[in] enable 启用
+		* @param[in] paint 绘图
+		*/
+		Algorithm(sfr::Area* area, sfr::Data* data, sfr::Enable* enable, sfr::Paint* paint = nullptr);
+
+		/*
+		* @brief 析构
+		*/
+		~Algorithm();
+
+		/*
+		* @brief 初始化
+		* @param[in] area 区域
+		* @param[in] data 数据
+		* @param[in] enable 启用
+		* @param[in] paint 绘图
+		* @return void
+		*/
+		void initialize(sfr::Area* area, sfr::Data* data, sfr::Enable* enable, sfr::Paint* paint = nullptr);
+
+		/*
+		* @brief 初始化,指定区域数量
+		* Area::_size统计进程内所有区域,多个Algorithm实例同时存在时须使用此接口
+		* @param[in] area 区域
+		* @param[in] size 区域数量
+		* @param[in] data 数据
+		* @param[in] enable 启用
+		* @param[in] paint 绘图
+		* @return void
+		*/
+		void initialize(sfr::Area* area, int size, sfr::Data* data, sfr::Enable* enable, sfr::Paint* paint = nullptr);
+
+		/*
+		* @brief 设置质量门限
+		* @param[in] gate 质量门限,为nullptr时不检查
+		* @return void
+		*/
+		void setGate(sfr::Gate* gate);
+
+		/*
+		* @brief 最近一次检查的图像质量
+		* @param[in] index 区域索引
+		* @return int 参考Quality
+		*/
+		int quality(int index) const;
+
+		/*
+		* @brief 最近一次定位或计算的失败原因
+		* @param[in] index 区域索引
+		* @return int 参考Reason
+		*/
+		int reason(int index) const;
+
+		/*
+		* @brief 失败原因的累计次数,REASON_OK为成功计算SFR的次数
+		* @param[in] index 区域索引
+		* @param[in] reason 参考Reason
+		* @return unsigned long long
+		*/
+		unsigned long long reasonCount(int index, int reason) const;
+
+		/*
+		* @brief 清空失败原因的累计次数
+		* @param[in] index 区域索引
+		* @return void
+		*/
+		void resetReason(int index);
+
+		/*
+		* @brief 是否计算[指定区域]
+		* @param[in] index 区域索引
+		* @return bool
+		*/
+		bool isCalculate(int index);
+
+		/*
+		* @brief 是否计算[指定区域],区域画面无明显变化时复用上次结果
+		* 本次的画面指纹在calculateSfr或accumulateSfr成功后才作为比较基准,calculateSfr失败时清除基准,下一帧必定计算
+		* @param[in] index 区域索引
+		* @param[in] source 源图像
+		* @return bool
+		*/
+		bool isCalculate(int index, const cv::Mat& source);
+
+		/*
+		* @brief 获取交叉线中心
+		* @param[in] index 区域索引
+		* @param[in] source 图像源(整个图像)
+		* @return bool
+		*/
+		bool getCrossLineCenter(int index, const cv::Mat& source);
+
+		/*
+		* @brief 计算SFR的ROI
+		* @param[in] index 区域索引
+		* @param[in] thresold 误差阈值(允许与上次获取的坐标相差+-threshold,则返回上次的坐标点)
+		* @return bool
+		*/
+		bool calculateRoi(int index, float threshold = 2.0f);
+
+		/*
+		* @brief 自动检测区域内的斜边并放置ROI,代替calculateRoi
+		* 在大津法二值化的区域内跟踪近似竖直的直边,每条边放置满足check_slope
+		* 角度与周期限制的最大ROI,并用sfr_edge_fit验证,按面积从大到小排列.
+		* ROI避开直边两端的4行及同一行相邻边界左右3列,避免角点与相邻边的模糊影响斜率.
+		* roi.width/roi.height大于0时作为ROI的最大尺寸,偏移不使用.
+		* @param[in] index 区域索引
+		* @param[in] source 源图像
+		* @return bool 找到至少一个ROI,第一个ROI作为当前ROI
+		*/
+		bool detectRoi(int index, const cv::Mat& source);
+
+		/*
+		* @brief detectRoi找到的ROI数量[线程安全]
+		* @param[in] index 区域索引
+		* @return int
+		*/
+		int roiCount(int index);
+
+		/*
+		* @brief 选择detectRoi找到的ROI作为当前ROI,之后调用calculateSfr计算此边
+		* @param[in] index 区域索引
+		* @param[in] roi ROI索引,小于roiCount
+		* @return bool
+		*/
+		bool selectRoi(int index, int roi);
+
+		/*
+		* @brief 整幅图像配准,代替逐个区域调用getCrossLineCenter
+		* 图卡为刚性平面,各区域中心由参考位置经单应性矩阵映射得到.未配准或验证失败时
+		* 对所有区域调用getCrossLineCenter并估计单应性矩阵;已配准时每帧只在预测位置附近
+		* 定位probeCount个区域作验证,残差超过registerTolerance时重新配准.
+		* 第一次配准成功时的区域中心作为参考位置,之后照常调用calculateRoi与calculateSfr.
+		* 固定中心的区域不参与配准,同一时刻只能有一个线程调用.
+		* @param[in] source 源图像
+		* @return bool
+		*/
+		bool registerChart(const cv::Mat& source);
+
+		/*
+		* @brief 清除配准与参考位置
+		* @return void
+		*/
+		void resetRegistration();
+
+		/*
+		* @brief 参考位置到图像的单应性矩阵
+		* @return cv::Mat 3x3,未配准时为空
+		*/
+		cv::Mat homography() const;
+
+		/*
+		* @brief 最近一次配准或验证的最大残差
+		* @return double 像素
+		*/
+		double registrationResidual() const;
+
+		/*
+		* @brief 计算SFR
+		* @param[in] index 区域索引
+		* @param[in] source 图像源(整个图像)
+		* @return bool
+		*/
+		bool calculateSfr(int index, const cv::Mat& source);
+
+		/*
+		* @brief 多帧累加计算SFR
+		* 每帧只拟合边缘并将ESF投影到超采样区间,累加frames帧后
+		* 统一计算LSF和DFT,结果与calculateSfr相同方式保存.
+		* ROI宽度变化时重新开始累加.
+		* @param[in] index 区域索引
+		* @param[in] source 图像源(整个图像)
+		* @param[in] frames 每次计算累加的帧数
+		* @return int 参考Accumulate
+		*/
+		int accumulateSfr(int index, const cv::Mat& source, int frames);
+
+		/*
+		* @brief 分通道计算SFR[线程安全]
+		* 在亮度上拟合一次边缘,三个通道在同一次遍历中投影到各自的超采样区间,
+		* 变换时DFT的三角函数三个通道共用,用于检查横向色差.
+		* 与calculateSfr相同地记录阶段耗时与失败原因.
+		* @param[in] index 区域索引
+		* @param[in] source 图像源(整个图像,BGR)
+		* @param[out] chroma 分通道结果
+		* @return bool
+		*/
+		bool calculateChroma(int index, const cv::Mat& source, sfr::Chroma& chroma);
+
+		/*
+		* @brief 清空多帧累加的ESF[线程安全]
+		* @param[in] index 区域索引
+		* @return void
+		*/
+		void resetAccumulate(int index);
+
+		/*
+		* @brief 将数据输出在图像上
+		* @param[in] index 区域索引
+		* @param[in|out] source 图像源(整个图像)
+		* @return void
+		*/
+		void putText(int index, cv::Mat& source);
+
+		/*
+		* @brief 设置绘图模式
+		* @param[in] mode 绘图模式,参考OverlayMode
+		* @return void
+		*/
+		void setOverlayMode(int mode);
+
+		/*
+		* @brief 绘图模式
+		* @return int
+		*/
+		int overlayMode() const;
+
+		/*
+		* @brief 预览[非线程安全]
+		* 将图像源缩放到副本上,并回放OVERLAY_DEFERRED模式下记录的绘图命令
+		* @param[in] source 图像源(整个图像)
+		* @param[out] display 预览图像
+		* @param[in] scale 缩放比例
+		* @return void
+		*/
+		void preview(const cv::Mat& source, cv::Mat& display, double scale = 1.0);
+
+		/*
+		* @brief 区域是否通过
+		* @return bool
+		*/
+		bool isPass() const;
+
+		/*
+		* @brief SFR的ROI[非线程安全]
+		* @param[in] index 区域索引
+		* @return cv::Rect
+		*/
+		cv::Rect roi(int index) const;
+
+		/*
+		* @brief SFR的值[线程安全]
+		* @param[in] index 区域索引
+		* @return double
+		*/
+		double value(int index);
+
+		/*
+		* @brief SFR的结果[线程安全]
+		* @param[in] index 区域索引
+		* @return bool
+		*/
+		bool result(int index);
+
+		/*
+		* @brief MTF曲线[线程安全]
+		* @param[in] index 区域索引
+		* @return MTF曲线MAP
+		*/
+		std::map<double, double> curve(int index);
+
+		/*
+		* @brief MTF曲线[线程安全]
+		* @param[in] index 区域索引
+		* @param[out] curve MTF曲线,容量足够时不分配内存
+		* @return bool 曲线是否为空
+		*/
+		bool curve(int index, sfr::Curve& curve);
+
+		/*
+		* @brief MTF指标[线程安全]
+		* @param[in] index 区域索引
+		* @param[out] metrics MTF50/MTF30/MTF10及Data::frequencies的插值
+		* @return bool 最近一次计算是否成功
+		*/
+		bool metrics(int index, sfr::Metrics& metrics);
+
+		/*
+		* @brief 边缘拟合[线程安全]
+		* @param[in] index 区域索引
+		* @param[out] fit 最近一次计算的边缘拟合
+		* @return bool 最近一次计算是否成功
+		*/
+		bool fit(int index, sfr::Fit& fit);
+
+		/*
+		* @brief 多帧统计[线程安全]
+		* @param[in] index 区域索引
+		* @param[out] estimate 最近Data::window帧的统计结果
+		* @return bool 是否稳定
+		*/
+		bool estimate(int index, sfr::Estimate& estimate);
+
+		/*
+		* @brief 是否稳定[线程安全]
+		* 置信区间半宽小于Data::tolerance时稳定,可以结束多帧平均
+		* @param[in] index 区域索引
+		* @return bool
+		*/
+		bool isStable(int index);
+
+		/*
+		* @brief 清空多帧统计[线程安全],例如运动之后开始新的测量
+		* @param[in] index 区域索引
+		* @return void
+		*/
+		void resetEstimate(int index);
+
+		/*
+		* @brief 阶段耗时的百分位[线程安全,可在其他线程轮询]
+		* @param[in] index 区域索引
+		* @param[in] stage 参考Stage
+		* @param[in] p 百分位(0~1)
+		* @return double 耗时(us)
+		*/
+		double timing(int index, int stage, double p) const;
+
+		/*
+		* @brief 阶段耗时直方图[线程安全,可在其他线程轮询]
+		* @param[in] index 区域索引
+		* @param[in] stage 参考Stage
+		* @return const sfr::Histogram&
+		*/
+		const sfr::Histogram& histogram(int index, int stage) const;
+
+		/*
+		* @brief 清空阶段耗时
+		* @param[in] index 区域索引
+		* @return void
+		*/
+		void resetTiming(int index);
+
+	protected:
+
+		/*
+		* @brief 定位中心
+		* @param[in|out] overlay 绘图层
+		* @param[in] size 图像尺寸
+		* @param[in] color 虚线颜色
+		* @param[in] thickness 线条粗细
+		* @return void
+		*/
+		void locateCenter(sfr::Overlay& overlay, const cv::Size& size, const cv::Scalar& color = CV_RGB(255, 250, 205), int thickness = 1) const;
+
+		/*
+		* @brief 画视场角
+		* @param[in|out] overlay 绘图层
+		* @param[in] size 图像尺寸
+		* @param[in] color 虚线颜色
+		* @param[in] thickness 线条粗细
+		* @return void
+		*/
+		void drawFov(sfr::Overlay& overlay, const cv::Size& size, const cv::Scalar& color = CV_RGB(255, 250, 205), int thickness = 1);
+
+		/*
+		* @brief 计算SFR
+		* @param[in] area 计算的区域
+		* @param[out] value SFR的值
+		* @param[out] curve MTF曲线
+		* @param[out] fit 边缘拟合
+		* @param[in,out] cache 复用的边缘拟合,验证通过则跳过拟合
+		* @param[out] timing 阶段耗时直方图(STAGE_SIZE个),可为nullptr
+		* @param[out] reason 失败原因,参考Reason,可为nullptr
+		* @return bool
+		*/
+		bool calculatesfr(const cv::Mat& area, double& value,
+			sfr::Curve* curve = nullptr, sfr::Fit* fit = nullptr, sfr::Fit* cache = nullptr,
+			sfr::Histogram* timing = nullptr, int* reason = nullptr);
+
+		/*
+		* @brief 记录失败原因
+		* @param[in] index 区域索引
+		* @param[in] reason 参考Reason
+		* @return bool 是否为REASON_OK
+		*/
+		bool setReason(int index, int reason);
+
+		/*
+		* @brief 在指定窗口内定位区域中心
+		* @param[in] index 区域索引
+		* @param[in] source 源图像
+		* @param[in] window 定位窗口(整个图像的坐标)
+		* @param[out] point 中心(整个图像的坐标)
+		* @return bool
+		*/
+		bool locateIn(int index, const cv::Mat& source, const cv::Rect& window, cv::Point2f& point);
+
+		/*
+		* @brief 定位所有区域并估计单应性矩阵
+		* @param[in] source 源图像
+		* @return bool
+		*/
+		bool fullRegister(const cv::Mat& source);
+
+		/*
+		* @brief 获取交叉点
+		* @param[in] line1S 线条1起点
+		* @param[in] line1E 线条1终点
+		* @param[in] line2S 线条2起点
+		* @param[in] line2E 线条2终点
+		* @param[in] value 交叉坐标
+		* @return bool
+		*/
+		bool getCrossPoint(const cv::Point2i& line1S, const cv::Point2i& line1E, const cv::Point2i& line2S, const cv::Point2i& line2E, cv::Point2f& value) const;
+
+		/*
+		* @brief 画点线
+		* @param[in|out] overlay 绘图层
+		* @param[in] p1 起点
+		* @param[in] p2 终点
+		* @param[in] color 颜色
+		* @param[in] thickness 线条粗细
+		* @return void
+		*/
+		void drawPointLine(sfr::Overlay& overlay, cv::Point2f p1, cv::Point2f p2, const cv::Scalar& color, int thickness) const;
+
+		/*
 		* @brief 画虚线
-		* @param[in|out] mat 图像
+		* @param[in|out] overlay 绘图层
 		* @param[in] p1 起点
 		* @param[in] p2 终点
 		* @param[in] color 颜色
 		* @param[in] thickness 线条粗细
 		* @return void
 		*/
-		void drawDottedLine(cv::Mat& img, cv::Point2f p1, cv::Point2f p2, const cv::Scalar& color, int thickness) const;
+		void drawDottedLine(sfr::Overlay& overlay, cv::Point2f p1, cv::Point2f p2, const cv::Scalar& color, int thickness) const;
+
+		/*
+		* @brief 静态绘图层[定位中心和视场角]
+		* 按图像尺寸和样式光栅化一次,尺寸/Paint/fovp变化时重新生成
+		* @param[in] size 图像尺寸
+		* @param[in] centerColor 中心线条颜色
+		* @param[in] centerThickness 中心线条粗细
+		* @param[in] fovColor 视场角线条颜色
+		* @param[in] fovThickness 视场角线条粗细
+		* @return void
+		*/
+		void drawStaticLayer(const cv::Size& size, const cv::Scalar& centerColor, int centerThickness,
+			const cv::Scalar& fovColor, int fovThickness);
 
 		/*
 		* @brief 默认将数据输出在图像上
@@ -473,11 +2254,71 @@ namespace sfr {
 		void putTextCustom(int index, cv::Mat& source);
 
 	private:
+		//FieldMap复用斜边检测与单边计算,内部缓冲区布局不属于公开接口
+		friend class FieldMap;
+
+		/*
+		* @brief 在灰度图中检测近似竖直的斜边并放置ROI,detectRoi与FieldMap共用
+		* @param[in] gray 灰度图(CV_8UC1)
+		* @param[in] maxWidth ROI最大宽度,小于等于0时不限制
+		* @param[in] maxHeight ROI最大高度,小于等于0时不限制
+		* @param[out] rois 通过sfr_edge_fit验证的ROI,相对于gray,按面积从大到小排列
+		* @return void
+		*/
+		static void findEdges(const cv::Mat& gray, int maxWidth, int maxHeight, std::vector<cv::Rect>& rois);
+
+		/*
+		* @brief 单个ROI的边缘拟合,ESF投影与变换,calculateSfr,accumulateSfr,calculateChroma与FieldMap共用
+		* 缓冲区均由调用方持有,尺寸不变时不再分配
+		* @param[in] sample 归一化的灰度ROI(CV_64FC1),用于拟合,color为空时同时用于投影
+		* @param[in] color 归一化的多通道ROI(CV_64FCn,n不大于4),可为空
+		* @param[in] fitted fit是否为已验证的拟合,是则跳过拟合
+		* @param[in,out] fit 边缘拟合
+		* @param[in,out] sums 超采样区间的和,长度为宽度x4x通道数,按通道依次存放,由调用方清零,多帧累加时保留
+		* @param[in,out] counts 超采样区间的计数,长度为宽度x4
+		* @param[out] curves 各通道的MTF曲线,为nullptr时只投影不变换
+		* @param[out] esf 各通道的ESF(长度为宽度x4),可为nullptr
+		* @param[out] timing 阶段耗时直方图(STAGE_SIZE个),可为nullptr
+		* @return int 0成功,否则为sfr_edge_fit的错误码
+		*/
+		static int calculateEdge(const cv::Mat& sample, const cv::Mat& color, bool fitted, sfr::Fit& fit,
+			double* sums, int* counts, sfr::Curve* curves, double** esf = nullptr, sfr::Histogram* timing = nullptr);
+
 		std::mutex m_mutex;
 		sfr::Area* m_area = nullptr;
+		int m_size = 0;
 		sfr::Data* m_data = nullptr;
 		sfr::Enable* m_enable = nullptr;
 		sfr::Paint* m_paint = nullptr;
+		sfr::Gate* m_gate = nullptr;
+		sfr::Curve m_curve;
+		std::vector<double> m_sums;
+		std::vector<int> m_counts;
+		cv::Mat m_gray;
+		cv::Mat m_sample;
+
+		//分通道计算的缓冲区
+		cv::Mat m_color;
+		std::vector<double> m_esf;
+
+		//配准的参考位置(整个图像的坐标)与单应性矩阵
+		std::vector<cv::Point2f> m_reference;
+		cv::Mat m_homography;
+		double m_residual = 0;
+		int m_probe = 0;
+		sfr::Overlay m_overlay;
+		int m_overlayMode = OVERLAY_DIRECT;
+
+		struct Layer {
+			cv::Size size;
+			cv::Scalar centerColor;
+			int centerThickness = 0;
+			cv::Scalar fovColor;
+			int fovThickness = 0;
+			double fovp = 0;
+			cv::Mat center;
+			cv::Mat fov;
+		} m_layer;
 	};
 }
 
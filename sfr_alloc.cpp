@@ -0,0 +1,239 @@
+﻿#include "sfr.h"
+#include "mitre_sfr.h"
+
+#ifdef LIBSFR_ALLOC_STATS
+#include <new>
+
+static std::atomic<unsigned long long> g_count[sfr::ALLOC_STAGE_SIZE];
+static std::atomic<unsigned long long> g_bytes[sfr::ALLOC_STAGE_SIZE];
+static std::atomic<unsigned long long> g_frames(0);
+static thread_local int t_stage = sfr::ALLOC_OTHER;
+
+static void countAlloc(size_t size)
+{
+	g_count[t_stage].fetch_add(1, std::memory_order_relaxed);
+	g_bytes[t_stage].fetch_add(size, std::memory_order_relaxed);
+}
+
+void* operator new(size_t size)
+{
+	countAlloc(size);
+	void* ptr = std::malloc(size ? size : 1);
+	if (!ptr) {
+		throw std::bad_alloc();
+	}
+	return ptr;
+}
+
+void* operator new[](size_t size)
+{
+	return operator new(size);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept
+{
+	countAlloc(size);
+	return std::malloc(size ? size : 1);
+}
+
+void* operator new[](size_t size, const std::nothrow_t& tag) noexcept
+{
+	return operator new(size, tag);
+}
+
+void operator delete(void* ptr) noexcept
+{
+	std::free(ptr);
+}
+
+void operator delete[](void* ptr) noexcept
+{
+	std::free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept
+{
+	std::free(ptr);
+}
+
+void operator delete[](void* ptr, size_t) noexcept
+{
+	std::free(ptr);
+}
+
+//cv::Mat的数据不经过operator new,包装默认分配器计数
+class CountingAllocator : public cv::MatAllocator {
+public:
+#if CV_VERSION_MAJOR >= 4
+	typedef cv::AccessFlag Flags;
+#else
+	typedef int Flags;
+#endif
+
+	cv::UMatData* allocate(int dims, const int* sizes, int type, void* data,
+		size_t* step, Flags flags, cv::UMatUsageFlags usage) const override
+	{
+		cv::UMatData* u = m_std->allocate(dims, sizes, type, data, step, flags, usage);
+		if (u && !data) {
+			countAlloc(u->size);
+		}
+		return u;
+	}
+
+	bool allocate(cv::UMatData* data, Flags flags, cv::UMatUsageFlags usage) const override
+	{
+		return m_std->allocate(data, flags, usage);
+	}
+
+	void deallocate(cv::UMatData* data) const override
+	{
+		m_std->deallocate(data);
+	}
+
+private:
+	cv::MatAllocator* m_std = cv::Mat::getStdAllocator();
+};
+
+static bool installCounting()
+{
+	static CountingAllocator allocator;
+	cv::Mat::setDefaultAllocator(&allocator);
+	return true;
+}
+#endif // LIBSFR_ALLOC_STATS
+
+/*
+* mitre_sfr临时缓冲区的线程内存池.
+* 一次SFR计算内的缓冲区全部释放后才回收,期间不足的部分先用malloc,
+* 回收时按本次的峰值扩容,预热后不再分配.
+*/
+struct Scratch {
+	std::vector<unsigned char> pool;
+	size_t offset = 0;
+	size_t demand = 0;
+	size_t peak = 0;
+	int live = 0;
+};
+
+static thread_local Scratch t_scratch;
+
+static void* scratchAlloc(size_t size)
+{
+	auto& scratch = t_scratch;
+	size = (size + 15) & ~(size_t)15;
+	scratch.demand += size;
+	scratch.peak = std::max<size_t>(scratch.peak, scratch.demand);
+	++scratch.live;
+	if (scratch.offset + size <= scratch.pool.size()) {
+		void* ptr = scratch.pool.data() + scratch.offset;
+		scratch.offset += size;
+		return ptr;
+	}
+#ifdef LIBSFR_ALLOC_STATS
+	countAlloc(size);
+#endif
+	return std::malloc(size);
+}
+
+static void scratchFree(void* ptr)
+{
+	if (!ptr) {
+		return;
+	}
+
+	auto& scratch = t_scratch;
+	unsigned char* data = (unsigned char*)ptr;
+	if (data < scratch.pool.data() || data >= scratch.pool.data() + scratch.pool.size()) {
+		std::free(ptr);
+	}
+
+	if (--scratch.live == 0) {
+		scratch.offset = 0;
+		scratch.demand = 0;
+		if (scratch.peak > scratch.pool.size()) {
+			scratch.pool.resize(scratch.peak);
+		}
+	}
+}
+
+sfr::AllocStats::AllocStats()
+{
+	for (int i = 0; i < ALLOC_STAGE_SIZE; ++i) {
+		count[i] = 0;
+		bytes[i] = 0;
+	}
+	frames = 0;
+}
+
+sfr::AllocStats::~AllocStats()
+{
+
+}
+
+sfr::AllocScope::AllocScope(int stage)
+{
+#ifdef LIBSFR_ALLOC_STATS
+	m_stage = t_stage;
+	t_stage = stage;
+#else
+	m_stage = stage;
+#endif
+}
+
+sfr::AllocScope::~AllocScope()
+{
+#ifdef LIBSFR_ALLOC_STATS
+	t_stage = m_stage;
+#endif
+}
+
+bool sfr::AllocScope::enabled()
+{
+#ifdef LIBSFR_ALLOC_STATS
+	static bool installed = installCounting();
+	return installed;
+#else
+	return false;
+#endif
+}
+
+void sfr::AllocScope::frame()
+{
+#ifdef LIBSFR_ALLOC_STATS
+	g_frames.fetch_add(1, std::memory_order_relaxed);
+#endif
+}
+
+void sfr::AllocScope::snapshot(sfr::AllocStats& stats)
+{
+#ifdef LIBSFR_ALLOC_STATS
+	for (int i = 0; i < ALLOC_STAGE_SIZE; ++i) {
+		stats.count[i] = g_count[i].load(std::memory_order_relaxed);
+		stats.bytes[i] = g_bytes[i].load(std::memory_order_relaxed);
+	}
+	stats.frames = g_frames.load(std::memory_order_relaxed);
+#else
+	stats = sfr::AllocStats();
+#endif
+}
+
+void sfr::AllocScope::reset()
+{
+#ifdef LIBSFR_ALLOC_STATS
+	for (int i = 0; i < ALLOC_STAGE_SIZE; ++i) {
+		g_count[i].store(0, std::memory_order_relaxed);
+		g_bytes[i].store(0, std::memory_order_relaxed);
+	}
+	g_frames.store(0, std::memory_order_relaxed);
+#endif
+}
+
+void sfr::AllocScope::installScratch()
+{
+#ifdef LIBSFR_ALLOC_STATS
+	enabled();
+#endif
+	//sfr_set_allocator是普通的全局写入,只在第一次调用时安装,之后的initialize不再改写
+	static std::once_flag once;
+	std::call_once(once, []() { sfr_set_allocator(scratchAlloc, scratchFree); });
+}
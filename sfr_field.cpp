@@ -0,0 +1,242 @@
+﻿#include "sfr.h"
+
+#include <limits>
+
+sfr::Field::Field()
+{
+	cellSize = 128;
+	roiWidth = 64;
+	roiHeight = 128;
+	frequency = 0.125;
+	horizontal = true;
+	interpolate = true;
+}
+
+sfr::Field::~Field()
+{
+
+}
+
+sfr::FieldMap::FieldMap(const sfr::Field& field)
+	: m_field(field)
+{
+
+}
+
+sfr::FieldMap::~FieldMap()
+{
+
+}
+
+bool sfr::FieldMap::measureEdge(const cv::Mat& roi, double frequency, double& value)
+{
+	thread_local cv::Mat sample;
+	thread_local std::vector<double> sums;
+	thread_local std::vector<int> counts;
+	thread_local sfr::Curve curve;
+	roi.convertTo(sample, CV_64FC1, 1.0 / 255.0);
+
+	sfr::Fit fit;
+	sums.assign(sample.cols * 4, 0.0);
+	counts.assign(sample.cols * 4, 0);
+	if (sfr::Algorithm::calculateEdge(sample, cv::Mat(), false, fit, sums.data(), counts.data(), &curve)) {
+		return false;
+	}
+
+	value = 0;
+	bool find = curve.interpolate(frequency, value);
+	value *= 100;
+	return find;
+}
+
+//没有边缘的单元用反距离平方加权插值
+static void fillCells(cv::Mat& map)
+{
+	std::vector<cv::Point> valid;
+	for (int y = 0; y < map.rows; ++y) {
+		for (int x = 0; x < map.cols; ++x) {
+			if (!std::isnan(map.at<double>(y, x))) {
+				valid.push_back(cv::Point(x, y));
+			}
+		}
+	}
+
+	if (valid.empty() || valid.size() == map.total()) {
+		return;
+	}
+
+	cv::Mat filled = map.clone();
+	for (int y = 0; y < map.rows; ++y) {
+		for (int x = 0; x < map.cols; ++x) {
+			if (!std::isnan(map.at<double>(y, x))) {
+				continue;
+			}
+
+			double sum = 0, weight = 0;
+			for (auto& point : valid) {
+				double w = 1.0 / ((point.x - x) * (point.x - x) + (point.y - y) * (point.y - y));
+				sum += w * map.at<double>(point);
+				weight += w;
+			}
+			filled.at<double>(y, x) = sum / weight;
+		}
+	}
+	map = filled;
+}
+
+int sfr::FieldMap::calculate(const cv::Mat& source)
+{
+	SFR_TRACE_SCOPE("FieldMap::calculate");
+	//按位深缩放到8位,16位按满量程,浮点按[0,1]
+	const int depth = source.depth();
+	const double scale = depth == CV_16U ? 255.0 / 65535.0 : depth == CV_32F || depth == CV_64F ? 255.0 : 1.0;
+	const int channels = source.channels();
+	if (channels == 3 || channels == 4) {
+		cv::cvtColor(source, m_gray, channels == 3 ? cv::COLOR_BGR2GRAY : cv::COLOR_BGRA2GRAY);
+		if (depth != CV_8U) {
+			m_gray.convertTo(m_gray, CV_8U, scale);
+		}
+	}
+	else if (channels == 1) {
+		source.convertTo(m_gray, CV_8U, scale);
+	}
+	else {
+		//其他通道数无法确定灰度,不计算
+		for (int d = 0; d < FIELD_DIRECTION_SIZE; ++d) {
+			m_map[d].release();
+		}
+		for (int d = 0; d < FIELD_BOTH; ++d) {
+			m_edges[d].clear();
+		}
+		return 0;
+	}
+
+	m_cell = std::max(16, m_field.cellSize);
+	const int rows = (m_gray.rows + m_cell - 1) / m_cell, cols = (m_gray.cols + m_cell - 1) / m_cell;
+	const int directions = m_field.horizontal ? 2 : 1;
+	const cv::Rect image(0, 0, m_gray.cols, m_gray.rows);
+	m_cells.resize(rows * cols * directions);
+
+	//各单元并行检测斜边,近似水平的边缘在转置后的单元上检测
+	cv::parallel_for_(cv::Range(0, (int)m_cells.size()), [&](const cv::Range& range) {
+		std::vector<cv::Rect> rois;
+		cv::Mat transposed;
+		for (int k = range.start; k < range.end; ++k) {
+			int cell = k / directions, direction = k % directions;
+			cv::Rect rect((cell % cols) * m_cell, (cell / cols) * m_cell, m_cell, m_cell);
+			rect &= image;
+
+			auto& jobs = m_cells[k];
+			jobs.clear();
+			if (direction == sfr::FIELD_VERTICAL) {
+				sfr::Algorithm::findEdges(m_gray(rect), m_field.roiWidth, m_field.roiHeight, rois);
+				for (auto& roi : rois) {
+					jobs.push_back({ roi + rect.tl(), cell, direction, 0, false });
+				}
+			}
+			else {
+				cv::transpose(m_gray(rect), transposed);
+				sfr::Algorithm::findEdges(transposed, m_field.roiWidth, m_field.roiHeight, rois);
+				for (auto& roi : rois) {
+					cv::Rect flip(rect.x + roi.y, rect.y + roi.x, roi.height, roi.width);
+					jobs.push_back({ flip, cell, direction, 0, false });
+				}
+			}
+		}
+		});
+
+	//按单元顺序合并,所有边缘并行批量计算
+	m_jobs.clear();
+	for (auto& jobs : m_cells) {
+		m_jobs.insert(m_jobs.end(), jobs.begin(), jobs.end());
+	}
+
+	cv::parallel_for_(cv::Range(0, (int)m_jobs.size()), [&](const cv::Range& range) {
+		cv::Mat transposed;
+		for (int k = range.start; k < range.end; ++k) {
+			auto& job = m_jobs[k];
+			cv::Mat roi = m_gray(job.roi);
+			if (job.direction == sfr::FIELD_HORIZONTAL) {
+				cv::transpose(roi, transposed);
+				roi = transposed;
+			}
+			job.result = measureEdge(roi, m_field.frequency, job.value);
+		}
+		});
+
+	//单元内取平均
+	const double nan = std::numeric_limits<double>::quiet_NaN();
+	std::vector<double> sum(rows * cols * FIELD_DIRECTION_SIZE, 0.0);
+	std::vector<int> count(rows * cols * FIELD_DIRECTION_SIZE, 0);
+	for (int d = 0; d < FIELD_BOTH; ++d) {
+		m_edges[d].clear();
+	}
+
+	int measured = 0;
+	for (auto& job : m_jobs) {
+		if (!job.result) {
+			continue;
+		}
+
+		for (int d : { job.direction, (int)FIELD_BOTH }) {
+			sum[d * rows * cols + job.cell] += job.value;
+			++count[d * rows * cols + job.cell];
+		}
+		m_edges[job.direction].push_back(job.roi);
+		++measured;
+	}
+
+	for (int d = 0; d < FIELD_DIRECTION_SIZE; ++d) {
+		auto& map = m_map[d];
+		map.create(rows, cols, CV_64FC1);
+		for (int cell = 0; cell < rows * cols; ++cell) {
+			int n = count[d * rows * cols + cell];
+			map.at<double>(cell / cols, cell % cols) = n ? sum[d * rows * cols + cell] / n : nan;
+		}
+
+		if (m_field.interpolate) {
+			fillCells(map);
+		}
+	}
+	return measured;
+}
+
+const cv::Mat& sfr::FieldMap::map(int direction) const
+{
+	return m_map[direction];
+}
+
+const std::vector<cv::Rect>& sfr::FieldMap::edges(int direction) const
+{
+	return m_edges[direction];
+}
+
+void sfr::FieldMap::draw(cv::Mat& display, int direction, double alpha) const
+{
+	const cv::Mat& map = m_map[direction];
+	if (map.empty() || display.empty() || display.channels() != 3) {
+		return;
+	}
+
+	//SFR值0~100映射到伪彩色,NaN的单元不绘制
+	cv::Mat level(map.size(), CV_8UC1), valid(map.size(), CV_8UC1);
+	for (int y = 0; y < map.rows; ++y) {
+		for (int x = 0; x < map.cols; ++x) {
+			double value = map.at<double>(y, x);
+			bool nan = std::isnan(value);
+			level.at<uchar>(y, x) = nan ? 0 : cv::saturate_cast<uchar>(value * 2.55);
+			valid.at<uchar>(y, x) = nan ? 0 : 255;
+		}
+	}
+
+	cv::Mat color, colorFull, validFull, blend;
+	cv::applyColorMap(level, color, cv::COLORMAP_JET);
+	cv::Size size(map.cols * m_cell, map.rows * m_cell);
+	cv::resize(color, colorFull, size, 0, 0, cv::INTER_NEAREST);
+	cv::resize(valid, validFull, size, 0, 0, cv::INTER_NEAREST);
+
+	cv::Rect rect = cv::Rect(0, 0, display.cols, display.rows) & cv::Rect(cv::Point(), size);
+	cv::Mat target = display(rect);
+	cv::addWeighted(target, 1 - alpha, colorFull(rect), alpha, 0, blend);
+	blend.copyTo(target, validFull(rect));
+}
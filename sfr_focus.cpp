@@ -0,0 +1,378 @@
+﻿#include "sfr.h"
+
+//黄金分割比例 (3 - sqrt(5)) / 2
+static const double GOLDEN_RATIO = 0.3819660112501051;
+
+sfr::ThroughFocus::ThroughFocus()
+{
+
+}
+
+sfr::ThroughFocus::~ThroughFocus()
+{
+
+}
+
+void sfr::ThroughFocus::start(long begin, long end, long step, long tolerance, int target, double drop)
+{
+	m_sample.clear();
+	m_areas = 0;
+	m_state = CLIMB;
+	m_target = target;
+	m_begin = begin;
+	m_end = end;
+	m_step = std::max<long>(std::abs(step), 1);
+	m_tolerance = std::max<long>(tolerance, 1);
+	m_last = begin;
+	m_drop = drop;
+	m_best = 0;
+	m_bestPosition = begin;
+}
+
+void sfr::ThroughFocus::add(const sfr::Frequency& frequency)
+{
+	double value[] = { frequency.center, frequency.leftTop, frequency.rightTop,
+		frequency.leftBottom, frequency.rightBottom };
+	add(frequency.motionPosition, value, MAX_AREA_SIZE);
+}
+
+void sfr::ThroughFocus::add(long position, const double* value, int count)
+{
+	Sample sample = {};
+	sample.position = position;
+	count = std::min<int>(count, MAX_AREA_SIZE);
+	for (int i = 0; i < count; ++i) {
+		sample.value[i] = value[i];
+	}
+	m_areas = std::max<int>(m_areas, count);
+
+	//按位置排序
+	auto iter = std::upper_bound(m_sample.begin(), m_sample.end(), position,
+		[](long position, const Sample& sample) {return position < sample.position; });
+	m_sample.insert(iter, sample);
+	m_last = position;
+
+	double f = objective(sample);
+	if (m_state == CLIMB) {
+		long direction = m_end >= m_begin ? 1 : -1;
+		if (m_sample.size() == 1 || f > m_best) {
+			m_best = f;
+			m_bestPosition = position;
+			if ((position - m_end) * direction >= 0) {
+				//到达终点仍在上升,峰值在终点
+				m_bracket[0] = m_bracket[1] = m_bracket[2] = position;
+				m_state = DONE;
+			}
+			return;
+		}
+
+		if (f >= m_best * (1.0 - m_drop)) {
+			if ((position - m_end) * direction >= 0) {
+				m_bracket[0] = m_bracket[1] = m_bracket[2] = m_bestPosition;
+				m_state = DONE;
+			}
+			return;
+		}
+
+		//峰值已被夹住,取峰值另一侧最近的样本
+		long other = m_bestPosition;
+		for (const auto& x : m_sample) {
+			bool opposite = (x.position - m_bestPosition) * (position - m_bestPosition) < 0;
+			if (opposite && (other == m_bestPosition ||
+				std::abs(x.position - m_bestPosition) < std::abs(other - m_bestPosition))) {
+				other = x.position;
+			}
+		}
+		m_bracket[0] = std::min<long>(other, position);
+		m_bracket[1] = m_bestPosition;
+		m_bracket[2] = std::max<long>(other, position);
+		m_state = GOLDEN;
+	}
+	else if (m_state == GOLDEN) {
+		long& a = m_bracket[0], & b = m_bracket[1], & c = m_bracket[2];
+		double fb = objective(b);
+		if (position > b && position < c) {
+			if (f > fb) {
+				a = b;
+				b = position;
+			}
+			else {
+				c = position;
+			}
+		}
+		else if (position < b && position > a) {
+			if (f > fb) {
+				c = b;
+				b = position;
+			}
+			else {
+				a = position;
+			}
+		}
+	}
+	else {
+		return;
+	}
+
+	long next = 0;
+	if (!this->next(next)) {
+		m_state = DONE;
+	}
+}
+
+bool sfr::ThroughFocus::next(long& position) const
+{
+	if (m_state == DONE) {
+		return false;
+	}
+
+	if (m_state == CLIMB) {
+		if (m_sample.empty()) {
+			position = m_begin;
+			return true;
+		}
+
+		long direction = m_end >= m_begin ? 1 : -1;
+		position = m_last + direction * m_step;
+		if ((position - m_end) * direction > 0) {
+			position = m_end;
+		}
+		return true;
+	}
+
+	long a = m_bracket[0], b = m_bracket[1], c = m_bracket[2];
+	if (c - a <= m_tolerance) {
+		return false;
+	}
+
+	//在较大的子区间内取黄金分割点
+	double x = (c - b) > (b - a) ? b + GOLDEN_RATIO * (c - b) : b - GOLDEN_RATIO * (b - a);
+	position = std::lround(x);
+	return position != a && position != b && position != c;
+}
+
+bool sfr::ThroughFocus::finished() const
+{
+	return m_state == DONE;
+}
+
+int sfr::ThroughFocus::samples() const
+{
+	return (int)m_sample.size();
+}
+
+int sfr::ThroughFocus::areas() const
+{
+	return m_areas;
+}
+
+bool sfr::ThroughFocus::peak(int area, double& position, double& value) const
+{
+	if (area < 0 || area >= m_areas || m_sample.empty()) {
+		return false;
+	}
+
+	int size = (int)m_sample.size(), top = 0;
+	for (int i = 1; i < size; ++i) {
+		if (m_sample[i].value[area] > m_sample[top].value[area]) {
+			top = i;
+		}
+	}
+	position = (double)m_sample[top].position;
+	value = m_sample[top].value[area];
+
+	//取最大值附近最多5个样本
+	int begin = std::max<int>(top - 2, 0);
+	int end = std::min<int>(top + 2, size - 1);
+	if (end - begin < 2) {
+		return true;
+	}
+
+	//y = a * t^2 + b * t + c, t = x - x[top]
+	double s0 = 0, s1 = 0, s2 = 0, s3 = 0, s4 = 0, y0 = 0, y1 = 0, y2 = 0;
+	for (int i = begin; i <= end; ++i) {
+		double t = (double)(m_sample[i].position - m_sample[top].position);
+		double y = m_sample[i].value[area];
+		s0 += 1;
+		s1 += t;
+		s2 += t * t;
+		s3 += t * t * t;
+		s4 += t * t * t * t;
+		y0 += y;
+		y1 += y * t;
+		y2 += y * t * t;
+	}
+
+	//克莱姆法则求解法方程
+	double d = s4 * (s2 * s0 - s1 * s1) - s3 * (s3 * s0 - s1 * s2) + s2 * (s3 * s1 - s2 * s2);
+	if (std::abs(d) <= 0.000001) {
+		return true;
+	}
+	double a = (y2 * (s2 * s0 - s1 * s1) - s3 * (y1 * s0 - s1 * y0) + s2 * (y1 * s1 - s2 * y0)) / d;
+	double b = (s4 * (y1 * s0 - s1 * y0) - y2 * (s3 * s0 - s1 * s2) + s2 * (s3 * y0 - y1 * s2)) / d;
+	double c = (s4 * (s2 * y0 - y1 * s1) - s3 * (s3 * y0 - y1 * s2) + y2 * (s3 * s1 - s2 * s2)) / d;
+	if (a >= 0) {
+		return true;
+	}
+
+	double t = -b / (2 * a);
+	double first = (double)(m_sample[begin].position - m_sample[top].position);
+	double last = (double)(m_sample[end].position - m_sample[top].position);
+	t = std::min<double>(std::max<double>(t, first), last);
+	position = m_sample[top].position + t;
+	value = a * t * t + b * t + c;
+	return true;
+}
+
+double sfr::ThroughFocus::objective(const Sample& sample) const
+{
+	if (m_target >= 0 && m_target < MAX_AREA_SIZE) {
+		return sample.value[m_target];
+	}
+
+	double sum = 0;
+	for (int i = 0; i < MAX_AREA_SIZE; ++i) {
+		sum += sample.value[i];
+	}
+	return sum;
+}
+
+double sfr::ThroughFocus::objective(long position) const
+{
+	//同一位置的多个样本取平均
+	double sum = 0;
+	int count = 0;
+	auto iter = std::lower_bound(m_sample.begin(), m_sample.end(), position,
+		[](const Sample& sample, long position) {return sample.position < position; });
+	for (; iter != m_sample.end() && iter->position == position; ++iter) {
+		sum += objective(*iter);
+		++count;
+	}
+	return count ? sum / count : 0;
+}
+
+sfr::Tilt::Tilt()
+{
+	x = 0;
+	y = 0;
+	focus = 0;
+	curvature = 0;
+	residual = 0;
+	count = 0;
+}
+
+sfr::Tilt::~Tilt()
+{
+
+}
+
+sfr::TiltSolver::TiltSolver()
+{
+
+}
+
+sfr::TiltSolver::~TiltSolver()
+{
+
+}
+
+void sfr::TiltSolver::initialize(const sfr::Area* area, int count, const cv::Size& size,
+	double pixelSize, double stepSize)
+{
+	m_count = std::min<int>(count, MAX_AREA_SIZE);
+	m_pixelSize = pixelSize > 0 ? pixelSize : 1;
+	m_stepSize = stepSize > 0 ? stepSize : 1;
+	m_ok = false;
+	m_tilt = sfr::Tilt();
+
+	//以图像中心为原点,单位mm
+	for (int i = 0; i < m_count; ++i) {
+		const auto& a = area[i];
+		cv::Point2d point(a.x + a.width / 2.0, a.y + a.height / 2.0);
+		if (a._point1.x != 0 || a._point1.y != 0) {
+			point = cv::Point2d(a.x + a._point1.x, a.y + a._point1.y);
+		}
+		m_point[i].x = (point.x - size.width / 2.0) * m_pixelSize / 1000.0;
+		m_point[i].y = (point.y - size.height / 2.0) * m_pixelSize / 1000.0;
+	}
+}
+
+bool sfr::TiltSolver::update(const sfr::ThroughFocus& focus)
+{
+	double peak[MAX_AREA_SIZE] = { 0 };
+	bool valid[MAX_AREA_SIZE] = { false };
+	for (int i = 0; i < m_count; ++i) {
+		double value = 0;
+		valid[i] = focus.peak(i, peak[i], value);
+	}
+	return update(peak, valid, m_count);
+}
+
+bool sfr::TiltSolver::update(const double* peak, const bool* valid, int count)
+{
+	count = std::min<int>(count, m_count);
+	int rows = 0;
+	double rr = 0;
+	cv::Mat a(count, 4, CV_64FC1), b(count, 1, CV_64FC1);
+	for (int i = 0; i < count; ++i) {
+		if (valid && !valid[i]) {
+			continue;
+		}
+		const auto& p = m_point[i];
+		a.at<double>(rows, 0) = 1;
+		a.at<double>(rows, 1) = p.x;
+		a.at<double>(rows, 2) = p.y;
+		a.at<double>(rows, 3) = p.x * p.x + p.y * p.y;
+		b.at<double>(rows, 0) = peak[i] * m_stepSize / 1000.0;
+		rr += a.at<double>(rows, 3);
+		++rows;
+	}
+
+	if (rows < 3) {
+		return false;
+	}
+
+	//少于4个区域时只拟合平面
+	int cols = rows < 4 ? 3 : 4;
+	cv::Mat x;
+	if (!cv::solve(a.rowRange(0, rows).colRange(0, cols), b.rowRange(0, rows), x, cv::DECOMP_SVD)) {
+		return false;
+	}
+
+	double z0 = x.at<double>(0, 0), kx = x.at<double>(1, 0), ky = x.at<double>(2, 0);
+	double kr = cols == 4 ? x.at<double>(3, 0) : 0;
+	double chi2 = 0;
+	for (int i = 0; i < rows; ++i) {
+		double z = z0 + kx * a.at<double>(i, 1) + ky * a.at<double>(i, 2) + kr * a.at<double>(i, 3);
+		chi2 += (b.at<double>(i, 0) - z) * (b.at<double>(i, 0) - z);
+	}
+
+	auto& tilt = m_tilt;
+	tilt.x = std::atan(kx) * 180.0 / CV_PI;
+	tilt.y = std::atan(ky) * 180.0 / CV_PI;
+	tilt.focus = z0 * 1000.0 / m_stepSize;
+	tilt.residual = std::sqrt(chi2 / rows) * 1000.0 / m_stepSize;
+	tilt.count = rows;
+
+	//视场边缘取参与拟合的区域的平均半径(不含中心)
+	int edge = 0;
+	for (int i = 0; i < rows; ++i) {
+		if (a.at<double>(i, 3) > 0) {
+			++edge;
+		}
+	}
+	tilt.curvature = edge ? kr * (rr / edge) * 1000.0 / m_stepSize : 0;
+	tilt.decenter = cv::Point2f();
+	if (std::abs(kr) > 0.000001) {
+		tilt.decenter.x = float(-kx / (2 * kr) * 1000.0 / m_pixelSize);
+		tilt.decenter.y = float(-ky / (2 * kr) * 1000.0 / m_pixelSize);
+	}
+	m_ok = true;
+	return true;
+}
+
+bool sfr::TiltSolver::result(sfr::Tilt& tilt) const
+{
+	tilt = m_tilt;
+	return m_ok;
+}
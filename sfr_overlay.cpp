@@ -0,0 +1,194 @@
+﻿#include "sfr.h"
+
+sfr::Overlay::Overlay()
+{
+
+}
+
+sfr::Overlay::~Overlay()
+{
+
+}
+
+void sfr::Overlay::bind(cv::Mat* target)
+{
+	m_target = target;
+	if (m_target) {
+		region(m_region);
+	}
+	else {
+		m_view.release();
+	}
+}
+
+void sfr::Overlay::clear()
+{
+	m_size = 0;
+	m_region = cv::Rect();
+	m_view = m_target ? *m_target : cv::Mat();
+}
+
+bool sfr::Overlay::empty() const
+{
+	return m_size == 0;
+}
+
+void sfr::Overlay::region(const cv::Rect& rect)
+{
+	m_region = rect;
+	if (m_target) {
+		m_view = rect.area() ? (*m_target)(rect) : *m_target;
+	}
+}
+
+void sfr::Overlay::line(const cv::Point2f& p1, const cv::Point2f& p2, const cv::Scalar& color, int thickness)
+{
+	auto& command = next(LINE);
+	command.p1 = p1;
+	command.p2 = p2;
+	command.color = color;
+	command.thickness = thickness;
+	commit(command);
+}
+
+void sfr::Overlay::rectangle(const cv::Rect& rect, const cv::Scalar& color, int thickness)
+{
+	auto& command = next(RECTANGLE);
+	command.p1 = cv::Point2f((float)rect.x, (float)rect.y);
+	command.size = rect.size();
+	command.color = color;
+	command.thickness = thickness;
+	commit(command);
+}
+
+void sfr::Overlay::circle(const cv::Point2f& center, int radius, const cv::Scalar& color, int thickness)
+{
+	auto& command = next(CIRCLE);
+	command.p1 = center;
+	command.size = cv::Size(radius, radius);
+	command.color = color;
+	command.thickness = thickness;
+	commit(command);
+}
+
+void sfr::Overlay::ellipse(const cv::Point& center, const cv::Size& axes, double angle,
+	double start, double end, const cv::Scalar& color, int thickness)
+{
+	auto& command = next(ELLIPSE);
+	command.p1 = center;
+	command.size = axes;
+	command.angle = angle;
+	command.start = start;
+	command.end = end;
+	command.color = color;
+	command.thickness = thickness;
+	commit(command);
+}
+
+void sfr::Overlay::putText(const cv::String& text, const cv::Point& org, int fontFace, double scale, const cv::Scalar& color, int thickness)
+{
+	auto& command = next(TEXT);
+	command.p1 = org;
+	command.font = fontFace;
+	command.scale = scale;
+	command.text = text;
+	command.color = color;
+	command.thickness = thickness;
+	commit(command);
+}
+
+void sfr::Overlay::mask(const cv::Mat& mask, const cv::Scalar& color)
+{
+	auto& command = next(MASK);
+	command.mat = mask;
+	command.color = color;
+	commit(command);
+}
+
+void sfr::Overlay::render(cv::Mat& img, double scale) const
+{
+	cv::Rect bound(0, 0, img.cols, img.rows);
+	for (int i = 0; i < m_size; ++i) {
+		const auto& command = m_command[i];
+		if (!command.region.area()) {
+			draw(img, command, scale);
+			continue;
+		}
+
+		cv::Rect rect((int)(command.region.x * scale), (int)(command.region.y * scale),
+			(int)(command.region.width * scale), (int)(command.region.height * scale));
+		rect &= bound;
+		if (rect.area()) {
+			cv::Mat view = img(rect);
+			draw(view, command, scale);
+		}
+	}
+}
+
+sfr::Overlay::Command& sfr::Overlay::next(int type)
+{
+	//直接绘制时不保存命令
+	if (m_target) {
+		m_direct.type = type;
+		return m_direct;
+	}
+
+	if (m_size == (int)m_command.size()) {
+		m_command.emplace_back();
+	}
+	auto& command = m_command[m_size++];
+	command.type = type;
+	command.region = m_region;
+	return command;
+}
+
+void sfr::Overlay::commit(const Command& command)
+{
+	if (m_target) {
+		draw(m_view, command, 1.0);
+	}
+}
+
+void sfr::Overlay::draw(cv::Mat& img, const Command& command, double scale)
+{
+	auto thickness = command.thickness;
+	if (scale != 1.0 && thickness > 0) {
+		thickness = std::max<int>(1, (int)std::lround(thickness * scale));
+	}
+
+	cv::Point2f p1(float(command.p1.x * scale), float(command.p1.y * scale));
+	cv::Point2f p2(float(command.p2.x * scale), float(command.p2.y * scale));
+	switch (command.type)
+	{
+	case LINE:
+		cv::line(img, p1, p2, command.color, thickness);
+		break;
+	case RECTANGLE:
+		cv::rectangle(img, cv::Rect((int)p1.x, (int)p1.y, (int)(command.size.width * scale),
+			(int)(command.size.height * scale)), command.color, thickness);
+		break;
+	case CIRCLE:
+		cv::circle(img, p1, std::max<int>(1, (int)std::lround(command.size.width * scale)), command.color, thickness);
+		break;
+	case ELLIPSE:
+		cv::ellipse(img, p1, cv::Size((int)(command.size.width * scale), (int)(command.size.height * scale)),
+			command.angle, command.start, command.end, command.color, thickness);
+		break;
+	case TEXT:
+		cv::putText(img, command.text, p1, command.font, command.scale * scale, command.color, thickness);
+		break;
+	case MASK:
+		if (command.mat.size() == img.size()) {
+			img.setTo(command.color, command.mat);
+		}
+		else {
+			//预览时缩放掩码,INTER_AREA保证细线不会断开
+			cv::Mat mask;
+			cv::resize(command.mat, mask, img.size(), 0, 0, cv::INTER_AREA);
+			img.setTo(command.color, mask);
+		}
+		break;
+	default:
+		break;
+	}
+}
@@ -0,0 +1,257 @@
+﻿#include "sfr.h"
+
+sfr::Fit::Fit()
+{
+	slope = 0;
+	angle = 0;
+	offset = 0;
+	centroid = 0;
+	intercept = 0;
+	r2 = 0;
+	avar = 0;
+	bvar = 0;
+	rows = 0;
+	cycles = 0;
+}
+
+sfr::Fit::~Fit()
+{
+
+}
+
+sfr::Estimate::Estimate()
+{
+	mean = 0;
+	variance = 0;
+	median = 0;
+	interval = 0;
+	count = 0;
+	stable = false;
+}
+
+sfr::Estimate::~Estimate()
+{
+
+}
+
+sfr::Estimator::Estimator()
+{
+
+}
+
+sfr::Estimator::~Estimator()
+{
+
+}
+
+void sfr::Estimator::reset(int window)
+{
+	m_window = std::max<int>(window, 1);
+	m_value.assign(m_window, 0);
+	m_sort.reserve(m_window);
+	clear();
+}
+
+void sfr::Estimator::clear()
+{
+	m_count = 0;
+	m_next = 0;
+}
+
+void sfr::Estimator::add(double value)
+{
+	if (m_window == 0) {
+		reset(1);
+	}
+
+	m_value[m_next] = value;
+	m_next = (m_next + 1) % m_window;
+	m_count = std::min<int>(m_count + 1, m_window);
+}
+
+int sfr::Estimator::count() const
+{
+	return m_count;
+}
+
+//t分布在(-t,t)内的概率,自由度为整数时的有限级数(Abramowitz & Stegun 26.7.3/26.7.4)
+static double studentProbability(double t, int dof)
+{
+	double theta = std::atan(t / std::sqrt((double)dof));
+	double c2 = std::cos(theta) * std::cos(theta), term = 1, sum = 1;
+	if (dof % 2 == 0) {
+		for (int k = 2; k <= dof - 2; k += 2) {
+			term *= c2 * (k - 1) / k;
+			sum += term;
+		}
+		return std::sin(theta) * sum;
+	}
+
+	if (dof == 1) {
+		return 2 * theta / CV_PI;
+	}
+
+	for (int k = 3; k <= dof - 2; k += 2) {
+		term *= c2 * (k - 1) / k;
+		sum += term;
+	}
+	return 2 / CV_PI * (theta + std::sin(theta) * std::cos(theta) * sum);
+}
+
+//与正态分布z倍标准差置信度相同的t分布分位数,二分求解
+static double studentQuantile(double z, int dof)
+{
+	double p = std::erf(z / std::sqrt(2.0));
+	double low = z, high = z;
+	while (studentProbability(high, dof) < p && high < 1e6) {
+		high *= 2;
+	}
+
+	for (int i = 0; i < 60; ++i) {
+		double middle = (low + high) / 2;
+		if (studentProbability(middle, dof) < p) {
+			low = middle;
+		}
+		else {
+			high = middle;
+		}
+	}
+	return high;
+}
+
+bool sfr::Estimator::estimate(double confidence, double tolerance, sfr::Estimate& estimate) const
+{
+	estimate = sfr::Estimate();
+	estimate.count = m_count;
+	if (m_count == 0) {
+		return false;
+	}
+
+	double sum = 0;
+	for (int i = 0; i < m_count; ++i) {
+		sum += m_value[i];
+	}
+	estimate.mean = sum / m_count;
+
+	m_sort.assign(m_value.begin(), m_value.begin() + m_count);
+	auto middle = m_sort.begin() + m_count / 2;
+	std::nth_element(m_sort.begin(), middle, m_sort.end());
+	estimate.median = *middle;
+	if (m_count % 2 == 0) {
+		estimate.median = (estimate.median + *std::max_element(m_sort.begin(), middle)) / 2;
+	}
+
+	if (m_count < 2) {
+		return false;
+	}
+
+	double sum2 = 0;
+	for (int i = 0; i < m_count; ++i) {
+		sum2 += (m_value[i] - estimate.mean) * (m_value[i] - estimate.mean);
+	}
+	estimate.variance = sum2 / (m_count - 1);
+
+	//帧数少时样本方差本身不可靠,使用n-1自由度的t分布,且至少MIN_STABLE帧才判断稳定
+	const int MIN_STABLE = 5;
+	double quantile = confidence > 0 ? studentQuantile(confidence, m_count - 1) : 0;
+	estimate.interval = quantile * std::sqrt(estimate.variance / m_count);
+	estimate.stable = m_count >= std::min(MIN_STABLE, m_window) && estimate.interval <= tolerance;
+	return true;
+}
+
+sfr::Histogram::Histogram()
+{
+	reset();
+}
+
+sfr::Histogram::~Histogram()
+{
+
+}
+
+int sfr::Histogram::bucket(unsigned long long ns)
+{
+	if (ns < 4) {
+		return (int)ns;
+	}
+
+	//最高位所在的2的幂e,及其后两位m
+	int e = 2;
+	while (e < 63 && (ns >> (e + 1)) != 0) {
+		++e;
+	}
+	int m = (int)((ns >> (e - 2)) & 3);
+	return std::min<int>(4 * (e - 1) + m, BUCKET_SIZE - 1);
+}
+
+double sfr::Histogram::value(int bucket)
+{
+	if (bucket < 4) {
+		return bucket;
+	}
+
+	//取桶的中点
+	int e = bucket / 4 + 1, m = bucket % 4;
+	double lower = std::ldexp(4.0 + m, e - 2), upper = std::ldexp(5.0 + m, e - 2);
+	return (lower + upper) / 2;
+}
+
+void sfr::Histogram::add(long long ns)
+{
+	unsigned long long value = ns > 0 ? (unsigned long long)ns : 0;
+	m_bucket[bucket(value)].fetch_add(1, std::memory_order_relaxed);
+	m_sum.fetch_add(value, std::memory_order_relaxed);
+	m_last.store(value, std::memory_order_relaxed);
+	m_count.fetch_add(1, std::memory_order_release);
+}
+
+double sfr::Histogram::percentile(double p) const
+{
+	//读取期间可能有新样本写入,以桶的合计为准
+	unsigned long long counts[BUCKET_SIZE], total = 0;
+	for (int i = 0; i < BUCKET_SIZE; ++i) {
+		counts[i] = m_bucket[i].load(std::memory_order_relaxed);
+		total += counts[i];
+	}
+
+	if (total == 0) {
+		return 0;
+	}
+
+	p = std::min(std::max(p, 0.0), 1.0);
+	unsigned long long target = std::max<unsigned long long>((unsigned long long)std::ceil(p * total), 1);
+	unsigned long long sum = 0;
+	for (int i = 0; i < BUCKET_SIZE; ++i) {
+		sum += counts[i];
+		if (sum >= target) {
+			return value(i) / 1000;
+		}
+	}
+	return value(BUCKET_SIZE - 1) / 1000;
+}
+
+double sfr::Histogram::mean() const
+{
+	unsigned long long count = m_count.load(std::memory_order_acquire);
+	return count ? (double)m_sum.load(std::memory_order_relaxed) / count / 1000 : 0;
+}
+
+double sfr::Histogram::last() const
+{
+	return m_last.load(std::memory_order_relaxed) / 1000.0;
+}
+
+unsigned long long sfr::Histogram::count() const
+{
+	return m_count.load(std::memory_order_acquire);
+}
+
+void sfr::Histogram::reset()
+{
+	for (auto& bucket : m_bucket) {
+		bucket.store(0, std::memory_order_relaxed);
+	}
+	m_count.store(0, std::memory_order_relaxed);
+	m_sum.store(0, std::memory_order_relaxed);
+	m_last.store(0, std::memory_order_relaxed);
+}
@@ -0,0 +1,217 @@
+﻿#include "sfr.h"
+
+/*
+* @brief 一阶贝塞尔函数
+* J1(x) = 1/π ∫[0,π] cos(τ - x sinτ) dτ,被积函数为周期函数,梯形积分收敛很快
+*/
+static double besselJ1(double x)
+{
+	const int count = 64;
+	double sum = 0;
+	for (int i = 0; i < count; ++i) {
+		double t = CV_PI * (i + 0.5) / count;
+		sum += std::cos(t - x * std::sin(t));
+	}
+	return sum / count;
+}
+
+/*
+* @brief 边缘扩展函数
+* 距边缘d(亮侧为正)处点扩散函数落在亮侧的比例
+*/
+static double spread(const sfr::Synth& synth, double d)
+{
+	if (synth.blur == sfr::BLUR_DEFOCUS && synth.radius > 0) {
+		double r = synth.radius;
+		if (d >= r) {
+			return 1;
+		}
+
+		if (d <= -r) {
+			return 0;
+		}
+		//圆盘在x>d部分的弓形面积
+		double segment = r * r * std::acos(d / r) - d * std::sqrt(r * r - d * d);
+		return 1 - segment / (CV_PI * r * r);
+	}
+
+	if (synth.sigma <= 0) {
+		return d >= 0 ? 1 : 0;
+	}
+	return 0.5 * (1 + std::erf(d / (synth.sigma * std::sqrt(2.0))));
+}
+
+sfr::Synth::Synth()
+{
+	angle = 5;
+	blur = BLUR_GAUSSIAN;
+	sigma = 0.8;
+	radius = 2;
+	black = 0.2;
+	white = 0.8;
+	noise = 0;
+	gamma = 1;
+	bits = 8;
+	oversample = 4;
+	seed = 0x12233;
+}
+
+sfr::Synth::~Synth()
+{
+
+}
+
+sfr::Generator::Generator(const sfr::Synth& synth)
+	: m_synth(synth)
+{
+	m_synth.oversample = std::max<int>(m_synth.oversample, 1);
+	m_synth.bits = std::min<int>(std::max<int>(m_synth.bits, 1), 16);
+}
+
+sfr::Generator::~Generator()
+{
+
+}
+
+cv::Mat sfr::Generator::edge(const cv::Size& size) const
+{
+	const int n = m_synth.oversample;
+	double theta = m_synth.angle * CV_PI / 180;
+	double c = std::cos(theta), s = std::sin(theta);
+	double cx = size.width / 2.0, cy = size.height / 2.0;
+
+	//像元内n*n个子采样点的平均即像元孔径积分
+	cv::Mat linear(size, CV_64FC1);
+	for (int y = 0; y < size.height; ++y) {
+		double* row = linear.ptr<double>(y);
+		for (int x = 0; x < size.width; ++x) {
+			double sum = 0;
+			for (int j = 0; j < n; ++j) {
+				double py = y + (j + 0.5) / n - cy;
+				for (int i = 0; i < n; ++i) {
+					double px = x + (i + 0.5) / n - cx;
+					sum += spread(m_synth, px * c - py * s);
+				}
+			}
+			row[x] = m_synth.black + (m_synth.white - m_synth.black) * sum / (n * n);
+		}
+	}
+	return encode(linear);
+}
+
+cv::Mat sfr::Generator::chart(const cv::Size& size, int locateType, int radius, double fovp,
+	std::vector<cv::Point2f>* centers) const
+{
+	bool sector = locateType == sfr::BLACK_SECTOR_WITH_WHITE_BACKGROUND ||
+		locateType == sfr::WHITE_SECTOR_WITH_BLACK_BACKGROUND;
+	bool trapezoid = locateType == sfr::BLACK_TRAPEZOID_WITH_WHITE_BACKGROUND ||
+		locateType == sfr::WHITE_TRAPEZOID_WITH_BLACK_BACKGROUND;
+	if ((!sector && !trapezoid) || radius <= 0 || size.area() <= 0) {
+		return cv::Mat();
+	}
+	bool black = locateType == sfr::BLACK_SECTOR_WITH_WHITE_BACKGROUND ||
+		locateType == sfr::BLACK_TRAPEZOID_WITH_WHITE_BACKGROUND;
+
+	//中心,左上,右上,左下,右下,四角位于视场fovp处
+	cv::Point2f center(size.width / 2.0f, size.height / 2.0f);
+	float dx = center.x * (float)fovp / 100, dy = center.y * (float)fovp / 100;
+	std::vector<cv::Point2f> points = {
+		center,
+		cv::Point2f(center.x - dx, center.y - dy),
+		cv::Point2f(center.x + dx, center.y - dy),
+		cv::Point2f(center.x - dx, center.y + dy),
+		cv::Point2f(center.x + dx, center.y + dy),
+	};
+
+	//超采样渲染,图标为左上与右下两个象限的扇形或方块,对顶于中心
+	const int n = m_synth.oversample;
+	double theta = m_synth.angle * CV_PI / 180;
+	double c = std::cos(theta), s = std::sin(theta);
+	cv::Mat fine(size.height * n, size.width * n, CV_32FC1, cv::Scalar(black ? 1 : 0));
+	float shape = black ? 0.0f : 1.0f;
+	for (auto& point : points) {
+		int extent = (int)std::ceil(radius * std::sqrt(2.0)) + 1;
+		cv::Rect box((int)((point.x - extent) * n), (int)((point.y - extent) * n), extent * 2 * n, extent * 2 * n);
+		box &= cv::Rect(0, 0, fine.cols, fine.rows);
+		for (int y = box.y; y < box.y + box.height; ++y) {
+			float* row = fine.ptr<float>(y);
+			double py = (y + 0.5) / n - point.y;
+			for (int x = box.x; x < box.x + box.width; ++x) {
+				double px = (x + 0.5) / n - point.x;
+				double u = px * c - py * s, v = px * s + py * c;
+				bool inside = sector ? u * u + v * v <= (double)radius * radius :
+					std::max(std::abs(u), std::abs(v)) <= radius;
+				if (inside && u * v > 0) {
+					row[x] = shape;
+				}
+			}
+		}
+	}
+
+	//在超采样尺度上施加点扩散函数,再按面积缩小即像元孔径积分
+	if (m_synth.blur == sfr::BLUR_DEFOCUS && m_synth.radius > 0) {
+		int r = (int)std::ceil(m_synth.radius * n);
+		cv::Mat kernel(r * 2 + 1, r * 2 + 1, CV_32FC1, cv::Scalar(0));
+		cv::circle(kernel, cv::Point(r, r), (int)std::round(m_synth.radius * n), cv::Scalar(1), -1);
+		kernel /= cv::sum(kernel)[0];
+		cv::filter2D(fine, fine, -1, kernel, cv::Point(-1, -1), 0, cv::BORDER_REPLICATE);
+	}
+	else if (m_synth.sigma > 0) {
+		cv::GaussianBlur(fine, fine, cv::Size(), m_synth.sigma * n, m_synth.sigma * n, cv::BORDER_REPLICATE);
+	}
+
+	cv::Mat linear;
+	cv::resize(fine, linear, size, 0, 0, cv::INTER_AREA);
+	linear.convertTo(linear, CV_64FC1, m_synth.white - m_synth.black, m_synth.black);
+	if (centers) {
+		*centers = points;
+	}
+	return encode(linear);
+}
+
+double sfr::Generator::mtf(double frequency, bool aperture) const
+{
+	double f = std::abs(frequency), value = 1;
+	if (m_synth.blur == sfr::BLUR_DEFOCUS && m_synth.radius > 0) {
+		double x = 2 * CV_PI * m_synth.radius * f;
+		value = x > 1e-12 ? 2 * besselJ1(x) / x : 1;
+	}
+	else {
+		value = std::exp(-2 * CV_PI * CV_PI * m_synth.sigma * m_synth.sigma * f * f);
+	}
+
+	if (aperture && f > 1e-12) {
+		value *= std::sin(CV_PI * f) / (CV_PI * f);
+	}
+	return std::abs(value);
+}
+
+cv::Mat sfr::Generator::encode(const cv::Mat& linear) const
+{
+	cv::Mat mat = linear.clone();
+	if (m_synth.noise > 0) {
+		cv::Mat noise(mat.size(), CV_64FC1);
+		cv::RNG rng(m_synth.seed);
+		rng.fill(noise, cv::RNG::NORMAL, 0, m_synth.noise);
+		mat += noise;
+	}
+
+	//2^bits级映射到输出类型的满量程
+	double level = (1 << m_synth.bits) - 1;
+	double full = m_synth.bits > 8 ? 65535 : 255;
+	for (int y = 0; y < mat.rows; ++y) {
+		double* row = mat.ptr<double>(y);
+		for (int x = 0; x < mat.cols; ++x) {
+			double value = std::min(std::max(row[x], 0.0), 1.0);
+			if (m_synth.gamma != 1) {
+				value = std::pow(value, 1 / m_synth.gamma);
+			}
+			row[x] = std::round(value * level) * full / level;
+		}
+	}
+
+	cv::Mat gray, color;
+	mat.convertTo(gray, m_synth.bits > 8 ? CV_16UC1 : CV_8UC1);
+	cv::cvtColor(gray, color, cv::COLOR_GRAY2BGR);
+	return color;
+}
@@ -0,0 +1,289 @@
+﻿#include "sfr.h"
+
+#ifdef LIBSFR_TRACE
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include <condition_variable>
+
+//每个线程缓冲区保存的事件数,必须为2的幂
+static const unsigned long long RING_SIZE = 8192;
+
+//事件,字段使用relaxed原子量,导出时与写入线程并发读取
+struct Event {
+	std::atomic<const char*> name;
+	std::atomic<long long> begin;
+	std::atomic<long long> end;
+};
+
+//单写多读的环形缓冲区,head为已写入的事件总数
+struct Ring {
+	Ring(int tid) : tid(tid), head(0), used(true) {}
+	int tid;
+	std::atomic<unsigned long long> head;
+	std::atomic<bool> used;
+	Event events[RING_SIZE];
+};
+
+static std::mutex g_mutex;
+static std::vector<std::shared_ptr<Ring>> g_rings;
+static std::atomic<long long> g_threshold(0);
+static std::atomic<bool> g_dumping(false);
+static std::string g_path;
+static thread_local int t_depth = 0;
+
+//阈值触发的导出在后台线程执行,不阻塞被测线程;导出期间的再次触发合并,文件按序号命名不覆盖
+struct Dumper {
+	~Dumper()
+	{
+		{
+			std::lock_guard<std::mutex> guard(mutex);
+			stop = true;
+		}
+		cv.notify_one();
+		if (thread.joinable()) {
+			thread.join();
+		}
+	}
+
+	void start()
+	{
+		std::lock_guard<std::mutex> guard(mutex);
+		if (!thread.joinable()) {
+			thread = std::thread(&Dumper::run, this);
+		}
+	}
+
+	void post()
+	{
+		{
+			std::lock_guard<std::mutex> guard(mutex);
+			pending = true;
+		}
+		cv.notify_one();
+	}
+
+	void run()
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		for (;;) {
+			cv.wait(lock, [this]() { return pending || stop; });
+			if (stop) {
+				return;
+			}
+
+			pending = false;
+			int number = ++sequence;
+			lock.unlock();
+			sfr::Trace::dump(numbered(number));
+			g_dumping.store(false);
+			lock.lock();
+		}
+	}
+
+	//slow.json -> slow-1.json
+	static std::string numbered(int number)
+	{
+		std::string path;
+		{
+			std::lock_guard<std::mutex> guard(g_mutex);
+			path = g_path;
+		}
+
+		auto slash = path.find_last_of("/\\");
+		auto dot = path.find_last_of('.');
+		if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) {
+			dot = path.size();
+		}
+		return path.substr(0, dot) + "-" + std::to_string(number) + path.substr(dot);
+	}
+
+	std::mutex mutex;
+	std::condition_variable cv;
+	std::thread thread;
+	bool pending = false;
+	bool stop = false;
+	int sequence = 0;
+};
+
+static Dumper g_dumper;
+
+static long long now()
+{
+	static const auto epoch = std::chrono::steady_clock::now();
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now() - epoch).count();
+}
+
+//线程退出时释放缓冲区,留给后续线程复用,已写入的事件仍可导出
+struct Holder {
+	Holder()
+	{
+		std::lock_guard<std::mutex> guard(g_mutex);
+		for (auto& ring : g_rings) {
+			bool expected = false;
+			if (ring->used.compare_exchange_strong(expected, true)) {
+				this->ring = ring;
+				return;
+			}
+		}
+		ring = std::make_shared<Ring>(static_cast<int>(g_rings.size()) + 1);
+		g_rings.push_back(ring);
+	}
+
+	~Holder()
+	{
+		ring->used.store(false);
+	}
+
+	std::shared_ptr<Ring> ring;
+};
+
+static Ring& ring()
+{
+	static thread_local Holder holder;
+	return *holder.ring;
+}
+
+static void record(const char* name, long long begin, long long end)
+{
+	Ring& r = ring();
+	auto head = r.head.load(std::memory_order_relaxed);
+	auto& event = r.events[head & (RING_SIZE - 1)];
+	//与导出线程的acquire栅栏配对:读到此次覆盖的字段时,必然也能看到之前的head
+	std::atomic_thread_fence(std::memory_order_release);
+	event.name.store(name, std::memory_order_relaxed);
+	event.begin.store(begin, std::memory_order_relaxed);
+	event.end.store(end, std::memory_order_relaxed);
+	r.head.store(head + 1, std::memory_order_release);
+}
+
+sfr::Trace::Trace(const char* name)
+	: m_name(name), m_begin(now())
+{
+	++t_depth;
+}
+
+sfr::Trace::~Trace()
+{
+	long long end = now();
+	int depth = --t_depth;
+	record(m_name, m_begin, end);
+
+	//只在线程最外层事件上检查阈值,交给后台线程导出
+	long long threshold = g_threshold.load(std::memory_order_relaxed);
+	if (depth == 0 && threshold > 0 && end - m_begin > threshold) {
+		bool expected = false;
+		if (g_dumping.compare_exchange_strong(expected, true)) {
+			g_dumper.post();
+		}
+	}
+}
+
+bool sfr::Trace::enabled()
+{
+	return true;
+}
+
+bool sfr::Trace::dump(const std::string& path)
+{
+	std::vector<std::shared_ptr<Ring>> rings;
+	{
+		std::lock_guard<std::mutex> guard(g_mutex);
+		rings = g_rings;
+	}
+
+	FILE* file = fopen(path.c_str(), "w");
+	if (!file) {
+		return false;
+	}
+
+	fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+	bool first = true;
+	for (auto& r : rings) {
+		fprintf(file, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,"
+			"\"args\":{\"name\":\"sfr-%d\"}}", first ? "" : ",", r->tid, r->tid);
+		first = false;
+
+		//读取期间被覆盖的事件丢弃
+		auto head = r->head.load(std::memory_order_acquire);
+		auto begin = head > RING_SIZE ? head - RING_SIZE : 0;
+		std::vector<std::pair<const char*, std::pair<long long, long long>>> events;
+		events.reserve(static_cast<size_t>(head - begin));
+		for (auto i = begin; i < head; ++i) {
+			auto& event = r->events[i & (RING_SIZE - 1)];
+			events.push_back({ event.name.load(std::memory_order_relaxed),
+				{ event.begin.load(std::memory_order_relaxed), event.end.load(std::memory_order_relaxed) } });
+		}
+
+		//写入线程可能正在写第tail个事件,其槽位与第tail-RING_SIZE个相同,也要丢弃;
+		//栅栏保证上面的relaxed读取不会重排到tail之后
+		std::atomic_thread_fence(std::memory_order_acquire);
+		auto tail = r->head.load(std::memory_order_acquire);
+		auto valid = tail + 1 > RING_SIZE ? tail + 1 - RING_SIZE : 0;
+		for (auto i = begin; i < head; ++i) {
+			if (i < valid) {
+				continue;
+			}
+
+			auto& event = events[static_cast<size_t>(i - begin)];
+			fprintf(file, ",\n{\"name\":\"%s\",\"cat\":\"sfr\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,"
+				"\"ts\":%.3f,\"dur\":%.3f}", event.first, r->tid,
+				event.second.first / 1000.0, (event.second.second - event.second.first) / 1000.0);
+		}
+	}
+	fprintf(file, "\n]}\n");
+	return fclose(file) == 0;
+}
+
+void sfr::Trace::setThreshold(double ms, const std::string& path)
+{
+	if (ms > 0) {
+		g_dumper.start();
+	}
+
+	std::lock_guard<std::mutex> guard(g_mutex);
+	g_path = path;
+	g_threshold.store(ms > 0 ? static_cast<long long>(ms * 1e6) : 0);
+}
+
+//head由写入线程独占递增,只能在没有线程记录事件时重置
+void sfr::Trace::clear()
+{
+	std::lock_guard<std::mutex> guard(g_mutex);
+	for (auto& r : g_rings) {
+		r->head.store(0, std::memory_order_release);
+	}
+}
+#else
+sfr::Trace::Trace(const char* name)
+	: m_name(name), m_begin(0)
+{
+
+}
+
+sfr::Trace::~Trace()
+{
+
+}
+
+bool sfr::Trace::enabled()
+{
+	return false;
+}
+
+bool sfr::Trace::dump(const std::string& path)
+{
+	return false;
+}
+
+void sfr::Trace::setThreshold(double ms, const std::string& path)
+{
+
+}
+
+void sfr::Trace::clear()
+{
+
+}
+#endif
@@ -0,0 +1,124 @@
+#include "sfr.h"
+
+/*
+* 稳定状态分配测试
+* 每帧完整执行getCrossLineCenter+calculateRoi+calculateSfr+calculateChroma+putText,
+* 三种绘图模式各自预热后连续计算N帧:
+* ALLOC_SFR阶段有任何分配即失败;
+* HEADLESS与DEFERRED模式的putText只记录命令,ALLOC_OVERLAY阶段有任何分配即失败;
+* DIRECT模式的putText与DEFERRED模式的preview实际光栅化,cv::putText与带掩码的setTo
+* 在OpenCV内部各申请一次临时缓冲区,每帧不超过DRAW_BUDGET次;
+* ALLOC_LOCATE阶段为OpenCV滤波与Canny内部的临时缓冲区,每帧不超过LOCATE_BUDGET次.
+* 两帧模糊不同的图卡交替输入,前后两半分别关闭与开启reuseFit,重新拟合与验证缓存两条路径都经过
+*/
+
+//定位阶段每帧允许的分配次数
+static const unsigned long long LOCATE_BUDGET = 128;
+
+//光栅化每帧允许的分配次数,4段文本+PASS+2个静态掩码
+static const unsigned long long DRAW_BUDGET = 7;
+
+//完整的一帧
+static bool frame(sfr::Algorithm& algorithm, const cv::Mat& chart, cv::Mat& canvas, cv::Mat& display, sfr::Chroma& chroma)
+{
+	chart.copyTo(canvas);
+	bool ok = algorithm.getCrossLineCenter(0, canvas) && algorithm.calculateRoi(0) &&
+		algorithm.calculateSfr(0, canvas) && algorithm.calculateChroma(0, canvas, chroma);
+	algorithm.putText(0, canvas);
+	if (algorithm.overlayMode() == sfr::OVERLAY_DEFERRED) {
+		algorithm.preview(canvas, display, 1.0);
+	}
+	sfr::AllocScope::frame();
+	return ok;
+}
+
+int main()
+{
+	if (!sfr::AllocScope::enabled()) {
+		printf("LIBSFR_ALLOC_STATS is not defined\n");
+		return 1;
+	}
+
+	const int size = 400, radius = size / 4;
+	std::vector<cv::Point2f> centers;
+	cv::Mat charts[2];
+	for (int i = 0; i < 2; ++i) {
+		sfr::Synth synth;
+		synth.sigma = 0.8 + 0.4 * i;
+		charts[i] = sfr::Generator(synth).chart(cv::Size(size * 3, size * 3),
+			sfr::BLACK_TRAPEZOID_WITH_WHITE_BACKGROUND, radius, 70, &centers);
+	}
+
+	sfr::Area area[1];
+	area[0].x = (int)centers[0].x - size / 2;
+	area[0].y = (int)centers[0].y - size / 2;
+	area[0].width = size;
+	area[0].height = size;
+	area[0].locateType = sfr::BLACK_TRAPEZOID_WITH_WHITE_BACKGROUND;
+	area[0].roi.width = 40;
+	area[0].roi.height = 50;
+	area[0].roi.xOffset = -area[0].roi.width / 2;
+	area[0].roi.yOffset = radius / 2 - area[0].roi.height / 2;
+	area[0].denoisePixel = 5;
+
+	sfr::Data data;
+	sfr::Enable enable;
+	sfr::Algorithm algorithm;
+	algorithm.initialize(area, &data, &enable);
+
+	const struct {
+		int mode;
+		const char* name;
+		unsigned long long overlay;
+	} modes[] = {
+		{ sfr::OVERLAY_HEADLESS, "headless", 0 },
+		{ sfr::OVERLAY_DEFERRED, "deferred", DRAW_BUDGET },
+		{ sfr::OVERLAY_DIRECT, "direct", DRAW_BUDGET },
+	};
+
+	const int warmup = 8, frames = 64;
+	cv::Mat canvas, display;
+	sfr::Chroma chroma;
+	int result = 0;
+	for (const auto& mode : modes) {
+		algorithm.setOverlayMode(mode.mode);
+		for (int i = 0; i < warmup; ++i) {
+			enable.reuseFit = i >= warmup / 2;
+			if (!frame(algorithm, charts[i & 1], canvas, display, chroma)) {
+				printf("%s: frame failed during warm-up\n", mode.name);
+				return 1;
+			}
+		}
+
+		sfr::AllocStats before, after;
+		sfr::AllocScope::snapshot(before);
+		for (int i = 0; i < frames; ++i) {
+			enable.reuseFit = i >= frames / 2;
+			frame(algorithm, charts[i & 1], canvas, display, chroma);
+		}
+		sfr::AllocScope::snapshot(after);
+
+		unsigned long long count[sfr::ALLOC_STAGE_SIZE], bytes[sfr::ALLOC_STAGE_SIZE];
+		for (int stage = 0; stage < sfr::ALLOC_STAGE_SIZE; ++stage) {
+			count[stage] = after.count[stage] - before.count[stage];
+			bytes[stage] = after.bytes[stage] - before.bytes[stage];
+		}
+		printf("%s, %d frames: locate %llu/%llu, sfr %llu/%llu, overlay %llu/%llu (allocations/bytes)\n",
+			mode.name, frames, count[sfr::ALLOC_LOCATE], bytes[sfr::ALLOC_LOCATE],
+			count[sfr::ALLOC_SFR], bytes[sfr::ALLOC_SFR], count[sfr::ALLOC_OVERLAY], bytes[sfr::ALLOC_OVERLAY]);
+
+		if (count[sfr::ALLOC_SFR] > 0) {
+			printf("%s: SFR stage allocated\n", mode.name);
+			result = 1;
+		}
+		if (count[sfr::ALLOC_OVERLAY] > mode.overlay * frames) {
+			printf("%s: overlay stage exceeds %llu allocations per frame\n", mode.name, mode.overlay);
+			result = 1;
+		}
+		if (count[sfr::ALLOC_LOCATE] > LOCATE_BUDGET * frames) {
+			printf("%s: locate stage exceeds %llu allocations per frame\n", mode.name, LOCATE_BUDGET);
+			result = 1;
+		}
+	}
+	return result;
+}
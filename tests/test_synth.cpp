@@ -0,0 +1,79 @@
+#include "sfr.h"
+
+/*
+* 合成刃边的精度测试
+* 高斯与离焦两种点扩散函数,calculateSfr测得的MTF与Generator::mtf的解析值在容差内一致;
+* 12位图像输出CV_16UC3,按FieldMap的方式缩放到8位后同样检查
+*/
+static bool measure(const sfr::Synth& synth, const char* name)
+{
+	const int width = 64, height = 128;
+	sfr::Generator generator(synth);
+	cv::Mat image = generator.edge(cv::Size(width * 2, height * 2));
+	int type = synth.bits > 8 ? CV_16UC3 : CV_8UC3;
+	if (image.type() != type) {
+		printf("%s: unexpected image type %d\n", name, image.type());
+		return false;
+	}
+
+	//亮电平须落在16位满量程上,而不是未缩放的2^bits级
+	if (image.depth() == CV_16U) {
+		double maxValue = 0;
+		cv::minMaxLoc(image.reshape(1), nullptr, &maxValue);
+		if (std::abs(maxValue - synth.white * 65535) > 65535.0 / ((1 << synth.bits) - 1)) {
+			printf("%s: white level %.0f is not scaled to 16 bits\n", name, maxValue);
+			return false;
+		}
+		image.convertTo(image, CV_8U, 255.0 / 65535.0);
+	}
+
+	sfr::Area area[1];
+	area[0].x = 0;
+	area[0].y = 0;
+	area[0].width = image.cols;
+	area[0].height = image.rows;
+	area[0].locateType = sfr::SEARCH_AREA_CENTER_FIXED_POSTION;
+	area[0].roi.width = width;
+	area[0].roi.height = height;
+	area[0].roi.xOffset = -width / 2;
+	area[0].roi.yOffset = -height / 2;
+
+	sfr::Data data;
+	sfr::Enable enable;
+	sfr::Algorithm algorithm;
+	algorithm.initialize(area, &data, &enable);
+	sfr::Curve curve;
+	if (!algorithm.getCrossLineCenter(0, image) || !algorithm.calculateRoi(0) ||
+		!algorithm.calculateSfr(0, image) || !algorithm.curve(0, curve)) {
+		printf("%s: calculateSfr failed\n", name);
+		return false;
+	}
+
+	const double tolerance = 0.02;
+	bool pass = true;
+	for (double f = 0.05; f <= 0.4; f += 0.05) {
+		double measured = 0, expected = generator.mtf(f);
+		curve.interpolate(f, measured);
+		bool ok = std::abs(measured - expected) <= tolerance;
+		printf("%s: f=%.2f measured %.4f expected %.4f%s\n", name, f, measured, expected, ok ? "" : " FAIL");
+		pass &= ok;
+	}
+	return pass;
+}
+
+int main()
+{
+	bool pass = true;
+	sfr::Synth synth;
+	synth.blur = sfr::BLUR_GAUSSIAN;
+	synth.sigma = 0.8;
+	pass &= measure(synth, "gaussian");
+
+	synth.blur = sfr::BLUR_DEFOCUS;
+	synth.radius = 2;
+	pass &= measure(synth, "defocus");
+
+	synth.bits = 12;
+	pass &= measure(synth, "defocus/12bit");
+	return pass ? 0 : 1;
+}